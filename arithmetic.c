@@ -11,11 +11,178 @@
  *              These are mostly arithmetic operations but also
  *              include other operations like I/O.
  *
+ *              Each machine has its own I/O object holding the file
+ *              descriptors it reads and writes. Output goes into a
+ *              large buffer that is written when it fills, before
+ *              input has to wait for more bytes, and when the program
+ *              halts. Input is read in bulk and handed out a byte at a
+ *              time.
+ *
+ *              A machine embedded through libum has no descriptors.
+ *              Its output goes to a function the host gives, straight
+ *              from the buffer, and its input is read in place from
+ *              whatever bytes the host last supplied.
+ *
  **************************************************************/
 
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
 #include "arithmetic.h"
+#include "mem.h"
 
 #define LV_REG_LSB 25
+#define IO_BUFFER_SIZE 65536
+
+/*
+ * Name: umIO
+ * Purpose: Buffered input and output for one machine
+ * Members: inFd, outFd - the file descriptors read and written, or -1 for
+ *                        a machine fed by its host
+ *          writeOutput, outputContext - where a host-fed machine's output
+ *                                       goes, or NULL to drop it
+ *          inputEnded - true once the host has said no more input is coming
+ *          unbuffered - if true, every output byte is written at once and
+ *                       input is read one byte at a time, so nothing is
+ *                       held back from an interactive user
+ *          outLength - the number of bytes waiting in outBuffer
+ *          inData - the input being handed out: inBuffer, or the host's
+ *                   bytes for a host-fed machine
+ *          inPosition, inLength - the part of inData not yet handed out
+ *          recording - if true, a copy of everything written is kept in
+ *                      record, so a checkpoint can replay the output that
+ *                      came before it
+ *          record, recordLength, recordCapacity - the copy
+ *          outBuffer, inBuffer - the buffers
+ */
+struct umIO {
+        int inFd;
+        int outFd;
+        umOutputFn writeOutput;
+        void *outputContext;
+        bool inputEnded;
+        bool unbuffered;
+        size_t outLength;
+        const uint8_t *inData;
+        size_t inPosition;
+        size_t inLength;
+        bool recording;
+        uint8_t *record;
+        size_t recordLength;
+        size_t recordCapacity;
+        uint8_t outBuffer[IO_BUFFER_SIZE];
+        uint8_t inBuffer[IO_BUFFER_SIZE];
+};
+
+/*
+ * Name: makeIO
+ * Purpose: Create the I/O object for one machine
+ * Parameters: The file descriptors to read input from and write output to
+ * Returns: The I/O object, buffered and not recording
+ * Notes: The descriptors are not closed by freeIO
+ */
+umIO makeIO(int inFd, int outFd)
+{
+        umIO io = ALLOC(sizeof(struct umIO));
+        io->inFd = inFd;
+        io->outFd = outFd;
+        io->writeOutput = NULL;
+        io->outputContext = NULL;
+        io->inputEnded = false;
+        io->unbuffered = false;
+        io->outLength = 0;
+        io->inData = io->inBuffer;
+        io->inPosition = 0;
+        io->inLength = 0;
+        io->recording = false;
+        io->record = NULL;
+        io->recordLength = 0;
+        io->recordCapacity = 0;
+        return io;
+}
+
+/*
+ * Name: makeHostIO
+ * Purpose: Create the I/O object for a machine its host feeds directly
+ * Parameters: The function to hand buffered output to, or NULL to drop it,
+ *             and a pointer to pass it
+ * Returns: The I/O object, buffered and not recording, with no input yet
+ * Notes: Output is handed over a buffer at a time, from the object's own
+ *        buffer and only for the length of the call. Input comes from
+ *        supplyInput
+ */
+umIO makeHostIO(umOutputFn writeOutput, void *outputContext)
+{
+        umIO io = makeIO(-1, -1);
+        io->writeOutput = writeOutput;
+        io->outputContext = outputContext;
+        return io;
+}
+
+/*
+ * Name: supplyInput
+ * Purpose: Give a host-fed machine more input
+ * Parameters: The I/O object, the bytes, the number of bytes
+ * Returns: None
+ * Notes: The bytes are not copied, so they must stay put until they have all
+ *        been read. Anything left from earlier input is dropped
+ */
+void supplyInput(umIO io, const uint8_t *bytes, size_t length)
+{
+        assert(io->inFd < 0);
+        io->inData = bytes;
+        io->inPosition = 0;
+        io->inLength = length;
+}
+
+/*
+ * Name: endInput
+ * Purpose: Tell a host-fed machine no more input is coming
+ * Parameters: The I/O object
+ * Returns: None
+ * Notes: Input still supplied is read first, then every input gives end of
+ *        input
+ */
+void endInput(umIO io)
+{
+        io->inputEnded = true;
+}
+
+/*
+ * Name: attachIO
+ * Purpose: Move a host-fed machine's I/O onto file descriptors
+ * Parameters: The I/O object, the descriptors to read input from and write
+ *             output to
+ * Returns: None
+ * Notes: Buffered output is handed to the host first. Supplied input that
+ *        was not read is dropped. Recording and buffering carry on as they
+ *        were
+ */
+void attachIO(umIO io, int inFd, int outFd)
+{
+        assert(io->inFd < 0 && inFd >= 0 && outFd >= 0);
+        flushOutput(io);
+        io->inFd = inFd;
+        io->outFd = outFd;
+        io->writeOutput = NULL;
+        io->inputEnded = false;
+        io->inData = io->inBuffer;
+        io->inPosition = 0;
+        io->inLength = 0;
+}
+
+/*
+ * Name: freeIO
+ * Purpose: Free an I/O object
+ * Parameters: The I/O object
+ * Returns: None
+ * Notes: Anything still buffered is lost; call flushOutput first
+ */
+void freeIO(umIO io)
+{
+        recordOutput(io, false);
+        FREE(io);
+}
 
 /*
  * Name: conditionalMove
@@ -85,30 +252,121 @@ uint32_t nand(uint32_t B, uint32_t C)
 
 /*
  * Name: output
- * Purpose: Output a value to standard output
- * Parameters: The value to output
+ * Purpose: Output a value to the machine's output
+ * Parameters: The I/O object, the value to output
  * Returns: None
- * Notes: The value must be between 0 and 255
+ * Notes: The value must be between 0 and 255. It is only buffered; see
+ *        flushOutput
  */
-void output(uint32_t C)
+void output(umIO io, uint32_t C)
 {
         assert(C < 256);
-        putchar(C);
+        (io->outBuffer)[io->outLength] = C;
+        (io->outLength)++;
+        if (io->outLength == IO_BUFFER_SIZE || io->unbuffered) {
+                flushOutput(io);
+        }
 }
 
 /*
  * Name: input
- * Purpose: Take in an input from standard input
- * Parameters: None
- * Returns: The inputted value
- * Notes: None
+ * Purpose: Take in an input from the machine's input
+ * Parameters: The I/O object
+ * Returns: The inputted value, or all 1s (0xFFFFFFFF) at end of input
+ * Notes: Buffered output is written before waiting on an empty input
+ *        buffer, so prompts appear before the program blocks. A host-fed
+ *        machine with nothing supplied is at end of input
  */
-uint32_t input()
+uint32_t input(umIO io)
 {
-        int curr_char = getchar();
+        if (io->inPosition == io->inLength) {
+                flushOutput(io);
+                if (io->inFd < 0) {
+                        return EOF;
+                }
+                ssize_t numRead;
+                do {
+                        numRead = read(io->inFd, io->inBuffer,
+                                       io->unbuffered ? 1 : IO_BUFFER_SIZE);
+                } while (numRead < 0 && errno == EINTR);
+                if (numRead <= 0) {
+                        return EOF;
+                }
+                io->inPosition = 0;
+                io->inLength = numRead;
+        }
+
+        uint32_t curr_char = (io->inData)[io->inPosition];
+        (io->inPosition)++;
         return curr_char;
 }
 
+/*
+ * Name: flushOutput
+ * Purpose: Write everything output has buffered
+ * Parameters: The I/O object
+ * Returns: None
+ * Notes: Must be called when the program halts. If the descriptor stops
+ *        taking output (a client that went away, say), the rest of the
+ *        program's output is dropped rather than stopping the process
+ */
+void flushOutput(umIO io)
+{
+        if (io->recording && io->outLength > 0) {
+                size_t needed = io->recordLength + io->outLength;
+                if (needed > io->recordCapacity) {
+                        io->recordCapacity = 2 * needed;
+                        if (io->record == NULL) {
+                                io->record = ALLOC(io->recordCapacity);
+                        }
+                        else {
+                                RESIZE(io->record, io->recordCapacity);
+                        }
+                }
+                memcpy(io->record + io->recordLength, io->outBuffer,
+                       io->outLength);
+                io->recordLength = needed;
+        }
+
+        if (io->outFd < 0) {
+                if (io->writeOutput != NULL && io->outLength > 0) {
+                        io->writeOutput(io->outputContext, io->outBuffer,
+                                        io->outLength);
+                }
+                io->outLength = 0;
+                return;
+        }
+
+        size_t written = 0;
+        while (written < io->outLength) {
+                ssize_t result = write(io->outFd, io->outBuffer + written,
+                                       io->outLength - written);
+                if (result < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (result <= 0) {
+                        io->outFd = -1;
+                        io->writeOutput = NULL;
+                        break;
+                }
+                written += result;
+        }
+        io->outLength = 0;
+}
+
+/*
+ * Name: setUnbufferedIO
+ * Purpose: Turn input and output buffering off or back on
+ * Parameters: The I/O object, true to write and read one byte at a time
+ * Returns: None
+ * Notes: Meant for interactive programs
+ */
+void setUnbufferedIO(umIO io, bool unbuffered)
+{
+        flushOutput(io);
+        io->unbuffered = unbuffered;
+}
+
 /*
  * Name: loadValue
  * Purpose: Determine the value that should be placed in a register based on the
@@ -120,4 +378,50 @@ uint32_t input()
 uint32_t loadValue(uint32_t instruction)
 {
         return Bitpack_getu(instruction, LV_REG_LSB, 0);
-}
\ No newline at end of file
+}
+
+/*
+ * Name: inputWouldBlock
+ * Purpose: Say whether the next input has to wait on the machine's input
+ * Parameters: The I/O object
+ * Returns: True if no input bytes are buffered and the host has not ended
+ *          the input
+ * Notes: None
+ */
+bool inputWouldBlock(umIO io)
+{
+        return io->inPosition == io->inLength && !io->inputEnded;
+}
+
+/*
+ * Name: recordOutput
+ * Purpose: Start or stop keeping a copy of everything written
+ * Parameters: The I/O object, true to start recording, false to stop and
+ *             drop the copy
+ * Returns: None
+ * Notes: Bytes still in the output buffer are recorded when they are flushed
+ */
+void recordOutput(umIO io, bool record)
+{
+        if (!record && io->record != NULL) {
+                FREE(io->record);
+                io->recordLength = 0;
+                io->recordCapacity = 0;
+        }
+        io->recording = record;
+}
+
+/*
+ * Name: getOutputRecord
+ * Purpose: Get everything recorded since recordOutput(io, true)
+ * Parameters: The I/O object, a pointer to store the number of recorded
+ *             bytes in
+ * Returns: The recorded bytes, or NULL if there are none
+ * Notes: Call flushOutput first to include buffered bytes. The pointer is
+ *        only valid until the next flush
+ */
+const uint8_t *getOutputRecord(umIO io, size_t *length)
+{
+        *length = io->recordLength;
+        return io->record;
+}
@@ -15,6 +15,7 @@
 #ifndef ARITHMETIC_INCLUDED
 #define ARITHMETIC_INCLUDED
 
+#include <stdbool.h>
 #include <stdio.h>
 #include "assert.h"
 #include "bitpack.h"
@@ -24,8 +25,24 @@ uint32_t add(uint32_t B, uint32_t C);
 uint32_t multiply(uint32_t B, uint32_t C);
 uint32_t divide(uint32_t B, uint32_t C);
 uint32_t nand(uint32_t B, uint32_t C);
-void output(uint32_t C);
-uint32_t input();
 uint32_t loadValue(uint32_t instruction);
 
+typedef struct umIO *umIO;
+typedef void (*umOutputFn)(void *context, const uint8_t *bytes,
+                           size_t length);
+
+umIO makeIO(int inFd, int outFd);
+umIO makeHostIO(umOutputFn writeOutput, void *outputContext);
+void supplyInput(umIO io, const uint8_t *bytes, size_t length);
+void endInput(umIO io);
+void attachIO(umIO io, int inFd, int outFd);
+void freeIO(umIO io);
+void output(umIO io, uint32_t C);
+uint32_t input(umIO io);
+void flushOutput(umIO io);
+void setUnbufferedIO(umIO io, bool unbuffered);
+bool inputWouldBlock(umIO io);
+void recordOutput(umIO io, bool record);
+const uint8_t *getOutputRecord(umIO io, size_t *length);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,378 @@
+/**************************************************************
+ *
+ *                     batch.c
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Implementation of the batch runner behind
+ *              ./um --batch.
+ *
+ *              A jobs file lists one job per line: a program, the
+ *              file it reads as input and the file it writes its
+ *              output to. Blank lines and lines starting with # are
+ *              skipped. Every job gets its own memory and I/O object,
+ *              so the machines share nothing while they run.
+ *
+ *              The jobs are split evenly between the worker threads
+ *              up front. Each worker runs jobs from the back of its
+ *              own queue, and once that is empty steals from the
+ *              front of the others', so a worker that drew short jobs
+ *              helps with the long ones. A job is a whole program
+ *              run, so each queue is guarded by a plain mutex.
+ *
+ **************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "batch.h"
+#include "memory.h"
+#include "arithmetic.h"
+#include "dispatch.h"
+#include "jit.h"
+#include "loader.h"
+
+/* Macro Definitions */
+#define JOB_FIELDS " \t\r\n"
+
+/*
+ * Name: job
+ * Purpose: One line of the jobs file
+ * Members: program - the UM program to run
+ *          input - the file the program reads as input
+ *          output - the file the program's output replaces
+ */
+typedef struct job {
+        char *program;
+        char *input;
+        char *output;
+} job;
+
+/*
+ * Name: jobQueue
+ * Purpose: The jobs one worker has left
+ * Members: lock - held while taking a job
+ *          front - index of the first job left
+ *          back - one past the index of the last job left
+ */
+typedef struct jobQueue {
+        pthread_mutex_t lock;
+        uint32_t front;
+        uint32_t back;
+} jobQueue;
+
+/*
+ * Name: batchInfo
+ * Purpose: Everything the workers share
+ * Members: jobs - every job in the file
+ *          queues - one queue per worker
+ *          numWorkers - the number of workers
+ *          useJit - run jobs with the JIT instead of the interpreter
+ *          failures - the number of jobs that could not be run
+ */
+typedef struct batchInfo {
+        job *jobs;
+        jobQueue *queues;
+        unsigned numWorkers;
+        bool useJit;
+        uint32_t failures;
+} batchInfo;
+
+/*
+ * Name: worker
+ * Purpose: What a worker thread is given when it starts
+ * Members: batch - the shared batch
+ *          self - the index of the worker's own queue
+ *          thread - the worker's thread
+ */
+typedef struct worker {
+        batchInfo *batch;
+        unsigned self;
+        pthread_t thread;
+} worker;
+
+/* Function Declarations */
+static uint32_t readJobs(const char *jobsPath, job **jobs);
+static void freeJobs(job *jobs, uint32_t numJobs);
+static char *copyString(const char *string);
+static void *runWorker(void *arg);
+static bool takeJob(jobQueue *queue, bool fromBack, uint32_t *jobIndex);
+static bool runJob(job *currJob, bool useJit);
+
+/*
+ * Name: runBatch
+ * Purpose: Run every job in a jobs file
+ * Parameters: The jobs file, the number of threads to run them on, whether
+ *             to use the JIT
+ * Returns: True if the file was read and every job ran
+ * Notes: The calling thread is one of the workers. A job that cannot be run
+ *        is reported on stderr and the rest still run
+ */
+bool runBatch(const char *jobsPath, unsigned numThreads, bool useJit)
+{
+        job *jobs;
+        uint32_t numJobs = readJobs(jobsPath, &jobs);
+        if (jobs == NULL) {
+                return false;
+        }
+
+        batchInfo batch;
+        batch.jobs = jobs;
+        batch.numWorkers = numThreads;
+        if (batch.numWorkers > numJobs) {
+                batch.numWorkers = numJobs;
+        }
+        if (batch.numWorkers == 0) {
+                batch.numWorkers = 1;
+        }
+        batch.useJit = useJit;
+        batch.failures = 0;
+
+        /* Give each worker an even share of the jobs to start with */
+        batch.queues = CALLOC(batch.numWorkers, sizeof(jobQueue));
+        worker *workers = CALLOC(batch.numWorkers, sizeof(worker));
+        for (unsigned i = 0; i < batch.numWorkers; i++) {
+                pthread_mutex_init(&(batch.queues)[i].lock, NULL);
+                (batch.queues)[i].front =
+                        (uint64_t) numJobs * i / batch.numWorkers;
+                (batch.queues)[i].back =
+                        (uint64_t) numJobs * (i + 1) / batch.numWorkers;
+                workers[i].batch = &batch;
+                workers[i].self = i;
+        }
+
+        /* Start the other workers, then work on this thread too */
+        unsigned started = 1;
+        for (; started < batch.numWorkers; started++) {
+                if (pthread_create(&workers[started].thread, NULL, runWorker,
+                                   &workers[started]) != 0) {
+                        break;
+                }
+        }
+        runWorker(&workers[0]);
+        for (unsigned i = 1; i < started; i++) {
+                pthread_join(workers[i].thread, NULL);
+        }
+
+        for (unsigned i = 0; i < batch.numWorkers; i++) {
+                pthread_mutex_destroy(&(batch.queues)[i].lock);
+        }
+        FREE(workers);
+        FREE(batch.queues);
+        freeJobs(jobs, numJobs);
+        return batch.failures == 0;
+}
+
+/*
+ * Name: readJobs
+ * Purpose: Read every job in a jobs file
+ * Parameters: The jobs file, a pointer to store the array of jobs in
+ * Returns: The number of jobs
+ * Notes: Stores NULL (after reporting why on stderr) if the file cannot be
+ *        read or a line does not have exactly three fields. The array is
+ *        freed by freeJobs
+ */
+static uint32_t readJobs(const char *jobsPath, job **jobs)
+{
+        *jobs = NULL;
+        FILE *jobsFile = fopen(jobsPath, "r");
+        if (jobsFile == NULL) {
+                fprintf(stderr, "%s: %s\n", jobsPath, strerror(errno));
+                return 0;
+        }
+
+        uint32_t numJobs = 0;
+        uint32_t capacity = 16;
+        job *list = ALLOC(capacity * sizeof(job));
+        char *line = NULL;
+        size_t lineSize = 0;
+        unsigned lineNumber = 0;
+        bool valid = true;
+        while (valid && getline(&line, &lineSize, jobsFile) != -1) {
+                lineNumber++;
+                char *fields[4];
+                char *save;
+                int numFields = 0;
+                for (char *field = strtok_r(line, JOB_FIELDS, &save);
+                     field != NULL && numFields < 4;
+                     field = strtok_r(NULL, JOB_FIELDS, &save)) {
+                        fields[numFields++] = field;
+                }
+                if (numFields == 0 || fields[0][0] == '#') {
+                        continue;
+                }
+                if (numFields != 3) {
+                        fprintf(stderr, "%s:%u: expected <um-file> "
+                                "<input-file> <output-file>\n",
+                                jobsPath, lineNumber);
+                        valid = false;
+                        break;
+                }
+
+                if (numJobs == capacity) {
+                        capacity *= 2;
+                        RESIZE(list, capacity * sizeof(job));
+                }
+                list[numJobs].program = copyString(fields[0]);
+                list[numJobs].input = copyString(fields[1]);
+                list[numJobs].output = copyString(fields[2]);
+                numJobs++;
+        }
+        free(line);
+        fclose(jobsFile);
+
+        if (!valid) {
+                freeJobs(list, numJobs);
+                return 0;
+        }
+        *jobs = list;
+        return numJobs;
+}
+
+/*
+ * Name: freeJobs
+ * Purpose: Free the jobs read by readJobs
+ * Parameters: The array of jobs, the number of jobs
+ * Returns: None
+ * Notes: None
+ */
+static void freeJobs(job *jobs, uint32_t numJobs)
+{
+        for (uint32_t i = 0; i < numJobs; i++) {
+                FREE(jobs[i].program);
+                FREE(jobs[i].input);
+                FREE(jobs[i].output);
+        }
+        FREE(jobs);
+}
+
+/*
+ * Name: copyString
+ * Purpose: Copy a string
+ * Parameters: The string
+ * Returns: The copy
+ * Notes: Freed with FREE
+ */
+static char *copyString(const char *string)
+{
+        size_t length = strlen(string) + 1;
+        char *copy = ALLOC(length);
+        memcpy(copy, string, length);
+        return copy;
+}
+
+/*
+ * Name: runWorker
+ * Purpose: Run jobs until none are left in any queue
+ * Parameters: The worker
+ * Returns: NULL
+ * Notes: Nothing is added to the queues once the batch starts, so a worker
+ *        that finds every queue empty is done
+ */
+static void *runWorker(void *arg)
+{
+        worker *self = arg;
+        batchInfo *batch = self->batch;
+        uint32_t jobIndex;
+
+        for (;;) {
+                /* Take from the back of our own queue, then steal */
+                bool found = takeJob(&(batch->queues)[self->self], true,
+                                     &jobIndex);
+                for (unsigned i = 1; !found && i < batch->numWorkers; i++) {
+                        unsigned victim = (self->self + i) % batch->numWorkers;
+                        found = takeJob(&(batch->queues)[victim], false,
+                                        &jobIndex);
+                }
+                if (!found) {
+                        return NULL;
+                }
+
+                if (!runJob(&(batch->jobs)[jobIndex], batch->useJit)) {
+                        __atomic_add_fetch(&batch->failures, 1,
+                                           __ATOMIC_RELAXED);
+                }
+        }
+}
+
+/*
+ * Name: takeJob
+ * Purpose: Take one job out of a queue
+ * Parameters: The queue, true to take from the back (the owner) or false to
+ *             take from the front (a thief), a pointer to store the job's
+ *             index in
+ * Returns: False if the queue was empty
+ * Notes: None
+ */
+static bool takeJob(jobQueue *queue, bool fromBack, uint32_t *jobIndex)
+{
+        bool found = false;
+        pthread_mutex_lock(&queue->lock);
+        if (queue->front < queue->back) {
+                found = true;
+                if (fromBack) {
+                        (queue->back)--;
+                        *jobIndex = queue->back;
+                }
+                else {
+                        *jobIndex = queue->front;
+                        (queue->front)++;
+                }
+        }
+        pthread_mutex_unlock(&queue->lock);
+        return found;
+}
+
+/*
+ * Name: runJob
+ * Purpose: Run one job's program to completion
+ * Parameters: The job, whether to use the JIT
+ * Returns: False (after reporting why on stderr) if a file could not be
+ *          opened or the program could not be loaded
+ * Notes: The output file is created or truncated
+ */
+static bool runJob(job *currJob, bool useJit)
+{
+        int inFd = open(currJob->input, O_RDONLY);
+        if (inFd < 0) {
+                fprintf(stderr, "%s: %s\n", currJob->input, strerror(errno));
+                return false;
+        }
+        int outFd = open(currJob->output, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (outFd < 0) {
+                fprintf(stderr, "%s: %s\n", currJob->output, strerror(errno));
+                close(inFd);
+                return false;
+        }
+
+        const uint8_t *programBytes;
+        uint32_t numInstructions;
+        bool loaded = mapProgramFile(currJob->program, &programBytes,
+                                     &numInstructions);
+        if (loaded) {
+                memoryInfo memory = makeMemoryInfo(programBytes,
+                                                   numInstructions);
+                unmapProgramFile(programBytes, numInstructions);
+                umIO io = makeIO(inFd, outFd);
+                if (useJit) {
+                        runProgramJit(memory, io);
+                }
+                else {
+                        runProgram(memory, io);
+                }
+                flushOutput(io);
+                freeIO(io);
+                freeMemory(memory);
+        }
+
+        close(inFd);
+        close(outFd);
+        return loaded;
+}
@@ -0,0 +1,21 @@
+/**************************************************************
+ *
+ *                     batch.h
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Interface for running many independent UM jobs in
+ *              one process
+ *
+ **************************************************************/
+
+#ifndef BATCH_INCLUDED
+#define BATCH_INCLUDED
+
+#include <stdbool.h>
+
+bool runBatch(const char *jobsPath, unsigned numThreads, bool useJit);
+
+#endif
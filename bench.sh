@@ -0,0 +1,113 @@
+#! /bin/bash
+
+# Purpose: Time the UM on midmark, sandmark and a scripted advent session,
+#          check every run's output, and print the results as JSON
+#
+# Usage: bash bench.sh [runs] [warmup runs]   (or "make bench")
+#
+# Each benchmark is run the warmup number of times first; the last warmup
+# run also measures peak RSS. Wall times come from the timed runs only.
+# Instruction counts are fixed by each program and its input, and were
+# measured with "make PROFILE=1" and "./um --profile"
+
+runs=${1:-5}
+warmup=${2:-1}
+executable="./um"
+
+if [ ! -x $executable ] || [ $runs -lt 1 ] || [ $warmup -lt 1 ] ; then
+        echo "Usage: bash bench.sh [runs >= 1] [warmup runs >= 1]" >&2
+        exit 1
+fi
+
+# name, program, standard input, expected output, instructions retired
+benchmarks=(
+        "midmark umbin/midmark.um /dev/null umbin/midmark.out 85070522"
+        "sandmark umbin/sandmark.umz /dev/null umbin/sandmark.out 2113497561"
+        "advent umbin/advent.umz umbin/advent.in umbin/advent.out 731346330"
+)
+
+# Run the UM once, setting peakRss to its high-water mark in kB. Uses GNU
+# time when it is installed and samples /proc otherwise
+measureRss() {
+        local program=$1 input=$2
+        if [ -x /usr/bin/time ] ; then
+                /usr/bin/time -f %M -o bench.rss \
+                        $executable $program < $input > bench.out
+                peakRss=$(tail -n 1 bench.rss)
+                rm -f bench.rss
+                return
+        fi
+
+        $executable $program < $input > bench.out &
+        local pid=$!
+        peakRss=0
+        while kill -0 $pid 2> /dev/null ; do
+                local hwm=$(awk '/^VmHWM/ { print $2 }' \
+                                /proc/$pid/status 2> /dev/null)
+                if [ -n "$hwm" ] ; then
+                        peakRss=$hwm
+                fi
+                sleep 0.01
+        done
+        wait $pid
+}
+
+status=0
+echo "{"
+echo "  \"runs\": $runs,"
+echo "  \"warmup\": $warmup,"
+echo "  \"benchmarks\": ["
+for ((b = 0; b < ${#benchmarks[@]}; b++)) ; do
+        read name program input expected instructions <<< "${benchmarks[b]}"
+        echo "running $name" >&2
+
+        for ((i = 1; i < warmup; i++)) ; do
+                $executable $program < $input > bench.out
+        done
+        measureRss $program $input
+        outputOk=true
+        cmp -s bench.out $expected || outputOk=false
+
+        times=""
+        for ((i = 0; i < runs; i++)) ; do
+                start=$(date +%s%N)
+                $executable $program < $input > bench.out
+                end=$(date +%s%N)
+                cmp -s bench.out $expected || outputOk=false
+                times="$times $((end - start))"
+        done
+        if [ $outputOk = false ] ; then
+                echo "$name: output differs from $expected" >&2
+                status=1
+        fi
+
+        separator=","
+        if [ $((b + 1)) = ${#benchmarks[@]} ] ; then
+                separator=""
+        fi
+        echo $times | tr ' ' '\n' | sort -n | awk \
+                -v name=$name -v instructions=$instructions \
+                -v rss=$peakRss -v ok=$outputOk -v separator="$separator" '
+                { t[NR] = $1 / 1e9; sum += t[NR] }
+                END {
+                        if (NR % 2) median = t[(NR + 1) / 2]
+                        else median = (t[NR / 2] + t[NR / 2 + 1]) / 2
+                        printf "    {\n"
+                        printf "      \"name\": \"%s\",\n", name
+                        printf "      \"output_ok\": %s,\n", ok
+                        printf "      \"wall_seconds\": {\"min\": %.4f, " \
+                               "\"median\": %.4f, \"mean\": %.4f, " \
+                               "\"max\": %.4f},\n",
+                               t[1], median, sum / NR, t[NR]
+                        printf "      \"instructions\": %.0f,\n", instructions
+                        printf "      \"instructions_per_second\": %.0f,\n",
+                               instructions / median
+                        printf "      \"peak_rss_kb\": %d\n", rss
+                        printf "    }%s\n", separator
+                }'
+done
+echo "  ]"
+echo "}"
+
+rm -f bench.out
+exit $status
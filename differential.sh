@@ -0,0 +1,33 @@
+#! /bin/sh
+
+# Purpose: Run random programs through every mode of um and report any whose
+#          output differs from plain um
+# Usage: ./differential.sh [number of programs] [first seed]
+# Notes: Each program is "./writetests -s SEED stress_random", which runs a
+#        loop of about 2000 iterations from a loaded copy of itself, so modes
+#        that optimize or compile loaded programs lazily switch part way
+#        through. A program that differs is kept as random-SEED.um
+
+count=${1:-600}
+seed=${2:-1}
+modes="--optimize --jit --checked"
+failed=0
+
+make um writetests || exit 1
+last=$((seed + count - 1))
+while [ $seed -le $last ] ; do
+        ./writetests -n 300000 -s $seed stress_random || exit 1
+        ./um stress_random.um > stress_random.expected 2>&1
+        for mode in $modes ; do
+                ./um $mode stress_random.um > stress_random.actual 2>&1
+                if ! cmp -s stress_random.expected stress_random.actual ; then
+                        echo "seed $seed: um $mode differs from um"
+                        cp stress_random.um "random-$seed.um"
+                        failed=$((failed + 1))
+                fi
+        done
+        seed=$((seed + 1))
+done
+rm -f stress_random.um stress_random.expected stress_random.actual
+echo "$count programs, $failed differences"
+[ $failed -eq 0 ]
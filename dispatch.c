@@ -0,0 +1,599 @@
+/**************************************************************
+ *
+ *                     dispatch.c
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Implementation of the UM command loop. Each opcode
+ *              has its own handler and control jumps straight from
+ *              one handler to the next.
+ *
+ *              By default the engine is direct threaded: every
+ *              handler ends by decoding the next instruction and
+ *              jumping through a table of label addresses (a GNU C
+ *              extension). Building with -DUM_SWITCH_DISPATCH (or
+ *              on a compiler without computed goto) selects a
+ *              portable switch statement instead.
+ *
+ *              Memory marks instructions that start common sequences
+ *              with a fused opcode. Their handlers run the whole
+ *              sequence, stepping through the following instructions'
+ *              own unpacked forms, and dispatch once.
+ *
+ *              A jump to the start of an optimized block carries on in
+ *              the optimized form of segment 0, and any other jump in
+ *              the plain one (see optimize.c). A program loaded from
+ *              another segment has no optimized form until countJump
+ *              has seen it jump within itself for a while.
+ *
+ *              The registers, program counter and unpacked program
+ *              are locals of the loop, and segment loads and stores
+ *              are inlined from memcore.h. Only the cold instructions
+ *              (map, unmap, loading another program) go through the
+ *              memory functions, with the state written back first.
+ *
+ **************************************************************/
+
+#include <setjmp.h>
+#include <string.h>
+#include <unistd.h>
+#include "dispatch.h"
+#include "memcore.h"
+#include "profile.h"
+
+/*
+ * Built a second time with -DUM_CHECKED_DISPATCH, this file gives the command
+ * loop behind runProgramChecked instead, which checks every fetch, segment
+ * load and store, program load and unmap before making it. It stops at the
+ * first bad one with the program counter at the instruction that made it,
+ * after printing a report.
+ */
+#ifdef UM_CHECKED_DISPATCH
+#define REPORT_FAULT(print)                                             \
+        do {                                                            \
+                SAVE_STATE();                                           \
+                flushOutput(io);                                        \
+                print;                                                  \
+                return false;                                           \
+        } while (0)
+#define CHECK_ACCESS(id, offset)                                        \
+        do {                                                            \
+                uint32_t badID = (id);                                  \
+                uint32_t badOffset = (offset);                          \
+                if (!inSegment(memory, badID, badOffset)) {             \
+                        pc--;                                           \
+                        REPORT_FAULT(printSegmentFault(memory, badID,   \
+                                                       badOffset,       \
+                                                       stderr));        \
+                }                                                       \
+        } while (0)
+#define CHECK_JUMP(id, offset) CHECK_ACCESS(id, offset)
+#define CHECK_UNMAP(id)                                                 \
+        do {                                                            \
+                uint32_t badID = (id);                                  \
+                if (badID == 0 || !isMapped(memory, badID)) {           \
+                        pc--;                                           \
+                        REPORT_FAULT(printUnmapFault(memory, badID));   \
+                }                                                       \
+        } while (0)
+#define LIMIT_FETCH()                                                   \
+        do {                                                            \
+                if (pc >= programLength) {                              \
+                        REPORT_FAULT(printSegmentFault(memory, 0, pc,   \
+                                                       stderr));        \
+                }                                                       \
+        } while (0)
+#define NOTE_PROGRAM() (programLength = (memory->segments)[0]->length)
+static bool runCheckedLoop(memoryInfo memory, umIO io);
+static void printUnmapFault(memoryInfo memory, uint32_t id);
+#endif
+
+/*
+ * Built a third time with -DUM_LIBRARY_DISPATCH, it gives runLimitedLoop, the
+ * loop behind libum. That loop runs every instruction on its own, sending a
+ * superinstruction to the handler of its first instruction (the ones after
+ * it are unpacked as usual), so the budget can stop it between any two. It
+ * checks everything that would crash the normal loop and stops with a fault
+ * instead, and stops before an input that would have to wait. Each stop
+ * leaves the program counter at the instruction that did not run. It never
+ * saves checkpoints, so it can be linked next to the normal loop.
+ */
+#ifdef UM_LIBRARY_DISPATCH
+#define STOP(status)                                                    \
+        do {                                                            \
+                SAVE_STATE();                                           \
+                limits->budget = budget;                                \
+                return (status);                                        \
+        } while (0)
+#define UNDO_FETCH()                                                    \
+        do {                                                            \
+                pc--;                                                   \
+                budget++;                                               \
+        } while (0)
+#define LIMIT_FETCH()                                                   \
+        do {                                                            \
+                if (budget == 0) {                                      \
+                        STOP(UM_BUDGET_EXHAUSTED);                      \
+                }                                                       \
+                if (pc >= programLength) {                              \
+                        limits->fault = UM_FAULT_PROGRAM_END;           \
+                        STOP(UM_FAULT);                                 \
+                }                                                       \
+                budget--;                                               \
+        } while (0)
+#define LIBRARY_OPCODE(op)                                              \
+        ((op) < FUSED_LV_SLOAD ? (op)                                   \
+         : (op) == FUSED_NAND_NAND || (op) == FUSED_NAND_NAND_NAND      \
+         ? NAND : LV)
+#define REQUIRE(condition, why)                                         \
+        do {                                                            \
+                if (!(condition)) {                                     \
+                        UNDO_FETCH();                                   \
+                        limits->fault = (why);                          \
+                        STOP(UM_FAULT);                                 \
+                }                                                       \
+        } while (0)
+#define WAIT_FOR_INPUT()                                                \
+        do {                                                            \
+                if (inputWouldBlock(io)) {                              \
+                        UNDO_FETCH();                                   \
+                        STOP(UM_NEEDS_INPUT);                           \
+                }                                                       \
+        } while (0)
+#define CHECK_ACCESS(id, offset)                                        \
+        REQUIRE(inSegment(memory, (id), (offset)), UM_FAULT_SEGMENT)
+#define CHECK_JUMP(id, offset)                                          \
+        REQUIRE((id) == 0 || isMapped(memory, (id)), UM_FAULT_SEGMENT)
+#define CHECK_UNMAP(id)                                                 \
+        REQUIRE((id) != 0 && isMapped(memory, (id)), UM_FAULT_UNMAP)
+#define NOTE_PROGRAM() (programLength = (memory->segments)[0]->length)
+#define FINISH(status) STOP(status)
+#define CHECKPOINT_AT_INPUT() ((void) 0)
+#else
+#define LIBRARY_OPCODE(op) (op)
+#define REQUIRE(condition, why) ((void) 0)
+#define WAIT_FOR_INPUT() ((void) 0)
+#ifdef UM_CHECKED_DISPATCH
+#define FINISH(status) return true
+#else
+#define CHECK_ACCESS(id, offset) ((void) 0)
+#define CHECK_JUMP(id, offset) ((void) 0)
+#define CHECK_UNMAP(id) ((void) 0)
+#define LIMIT_FETCH() ((void) 0)
+#define NOTE_PROGRAM() ((void) 0)
+#define FINISH(status) return
+#endif
+/* A pending checkpoint resumes at the input, not the instruction after it */
+#define CHECKPOINT_AT_INPUT()                                           \
+        do {                                                            \
+                if (memory->checkpointPath != NULL) {                   \
+                        pc--;                                           \
+                        SAVE_STATE();                                   \
+                        checkpointBeforeInput(memory, io);              \
+                        pc++;                                           \
+                }                                                       \
+        } while (0)
+#endif
+
+/* Macro Definitions */
+#define A (currInstruction->a)
+#define B (currInstruction->b)
+#define C (currInstruction->c)
+
+#if defined(__GNUC__) && !defined(UM_SWITCH_DISPATCH)
+#define UM_THREADED_DISPATCH 1
+/* Labels as values are an extension that -pedantic would flag on every use */
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+/*
+ * The registers, program counter and unpacked program live in locals while
+ * the loop runs. SAVE_STATE writes them back to memory before anything in
+ * memory.c that reads them, and LOAD_STATE picks them up again afterwards,
+ * since loading a program moves the counter. Only jumps choose which unpacked
+ * form of segment 0 to run (see programAt), so the optimized form is kept
+ * across the calls in the middle of a block.
+ */
+#define SAVE_STATE()                                                    \
+        do {                                                            \
+                memcpy(memory->allRegs, regs, sizeof(regs));            \
+                memory->programCounter = pc;                            \
+        } while (0)
+#define LOAD_STATE()                                                    \
+        do {                                                            \
+                memcpy(regs, memory->allRegs, sizeof(regs));            \
+                pc = memory->programCounter;                            \
+        } while (0)
+
+/*
+ * CALL_MEMORY runs one of the memory functions that take the register
+ * numbers of an instruction, for the cold instructions only. Memory
+ * statistics asked for by SIGUSR1 are written there and before input, where
+ * no segment is half updated.
+ */
+#define CALL_MEMORY(function)                                           \
+        do {                                                            \
+                uint32_t regsInCommand[3] = { A, B, C };                \
+                SAVE_STATE();                                           \
+                function(regsInCommand, memory);                        \
+                writeRequestedStats(memory, STDERR_FILENO);             \
+                LOAD_STATE();                                           \
+        } while (0)
+
+/*
+ * FETCH reads the already unpacked instruction at the program counter (and
+ * counts it in a profiling build, or against the budget in the library).
+ * DISPATCH transfers control to the handler for its opcode, and NEXT does
+ * both, ending every handler.
+ */
+#define FETCH()                                                         \
+        do {                                                            \
+                LIMIT_FETCH();                                          \
+                currInstruction = &program[pc];                         \
+                opcode = LIBRARY_OPCODE(currInstruction->opcode);       \
+                PROFILE_INSTRUCTION(pc, opcode);                        \
+                pc++;                                                   \
+        } while (0)
+
+/*
+ * The RUN_ macros do the work of one instruction that has been fetched, so
+ * the plain handlers and the superinstructions share it. STEP moves on to the
+ * next instruction of a sequence without dispatching.
+ */
+#define RUN_CMOV()                                                      \
+        do {                                                            \
+                if (regs[C] != 0) {                                     \
+                        regs[A] = regs[B];                              \
+                }                                                       \
+        } while (0)
+#define RUN_NAND() (regs[A] = ~(regs[B] & regs[C]))
+#define RUN_SLOAD()                                                     \
+        do {                                                            \
+                CHECK_ACCESS(regs[B], regs[C]);                         \
+                regs[A] = loadWord(memory, regs[B], regs[C]);           \
+        } while (0)
+#define RUN_SSTORE()                                                    \
+        do {                                                            \
+                CHECK_ACCESS(regs[A], regs[B]);                         \
+                storeWord(memory, regs[A], regs[B], regs[C]);           \
+        } while (0)
+
+/* A jump within segment 0 only moves the program counter */
+#define RUN_LOADP()                                                     \
+        do {                                                            \
+                CHECK_JUMP(regs[B], regs[C]);                           \
+                if (regs[B] == 0) {                                     \
+                        PROFILE_LOAD_PROGRAM(true, 0);                  \
+                        pc = regs[C];                                   \
+                        countJump(memory);                              \
+                } else {                                                \
+                        CALL_MEMORY(loadProgram);                       \
+                        NOTE_PROGRAM();                                 \
+                }                                                       \
+                program = programAt(memory, pc);                        \
+        } while (0)
+#define RUN_LV() (regs[currInstruction->a] = currInstruction->value)
+#define STEP()                                                          \
+        do {                                                            \
+                currInstruction++;                                      \
+                pc++;                                                   \
+        } while (0)
+
+#ifdef UM_THREADED_DISPATCH
+#define HANDLER(op) op##_HANDLER:
+#define DISPATCH() goto *dispatchTable[opcode]
+#define NEXT() do { FETCH(); DISPATCH(); } while (0)
+#else
+#define HANDLER(op) case op:
+#define DISPATCH() switch (opcode)
+#define NEXT() continue
+#endif
+
+/*
+ * Name: runProgram
+ * Purpose: Execute the program in segment 0 until it halts
+ * Parameters: The struct containing the memory structures and variables, the
+ *             machine's I/O object
+ * Returns: None
+ * Notes: Opcodes 14 and 15 are not UM instructions and are skipped, just as
+ *        the original if/else command loop did.
+ *        Only the last instruction of a superinstruction may change the
+ *        program counter or segment 0, so the ones before it can step
+ *        through the unpacked program directly.
+ *        The registers and program counter are copied in at the start and
+ *        back out when the program halts, so memory sees them as they were
+ *        left
+ */
+#ifdef UM_LIBRARY_DISPATCH
+/*
+ * Name: runLimitedLoop
+ * Purpose: Execute the program in segment 0 until it halts, runs out of
+ *          budget, needs input nobody has supplied or makes a fault
+ * Parameters: The struct containing the memory structures and variables, the
+ *             machine's I/O object, the budget and memory limit
+ * Returns: Why it stopped. The budget left is written back to limits, and
+ *          so is the fault for UM_FAULT
+ * Notes: Memory must not be optimized. Calling it again after anything but
+ *        UM_HALTED or UM_FAULT carries on where it stopped
+ */
+um_status runLimitedLoop(memoryInfo memory, umIO io, runLimits *limits)
+#elif defined(UM_CHECKED_DISPATCH)
+/*
+ * Name: runCheckedLoop
+ * Purpose: Execute the program in segment 0 until it halts or makes a bad
+ *          segment access
+ * Parameters: The struct containing the memory structures and variables, the
+ *             machine's I/O object
+ * Returns: True if it halted, false if it reported a bad access
+ * Notes: See runProgramChecked
+ */
+static bool runCheckedLoop(memoryInfo memory, umIO io)
+#else
+void runProgram(memoryInfo memory, umIO io)
+#endif
+{
+        unsigned opcode = 0;
+        uint32_t regs[NUM_REGS];
+        uint32_t pc;
+        const Um_decoded *program;
+        const Um_decoded *currInstruction;
+
+        LOAD_STATE();
+        program = programAt(memory, pc);
+#ifdef UM_LIBRARY_DISPATCH
+        assert(program == memory->decoded);
+        uint64_t budget = limits->budget;
+#endif
+#if defined(UM_LIBRARY_DISPATCH) || defined(UM_CHECKED_DISPATCH)
+        uint32_t programLength;
+        NOTE_PROGRAM();
+#endif
+
+#ifdef UM_THREADED_DISPATCH
+        static void *const dispatchTable[NUM_DECODED_OPCODES] = {
+                &&CMOV_HANDLER, &&SLOAD_HANDLER, &&SSTORE_HANDLER,
+                &&ADD_HANDLER, &&MUL_HANDLER, &&DIV_HANDLER,
+                &&NAND_HANDLER, &&HALT_HANDLER, &&ACTIVATE_HANDLER,
+                &&INACTIVATE_HANDLER, &&OUT_HANDLER, &&IN_HANDLER,
+                &&LOADP_HANDLER, &&LV_HANDLER,
+                &&INVALID_HANDLER, &&INVALID_HANDLER,
+                &&FUSED_LV_SLOAD_HANDLER, &&FUSED_LV_SSTORE_HANDLER,
+                &&FUSED_LV_LV_HANDLER, &&FUSED_LV_LOADP_HANDLER,
+                &&FUSED_NAND_NAND_HANDLER, &&FUSED_NAND_NAND_NAND_HANDLER,
+                &&FUSED_LV_CMOV_LOADP_HANDLER,
+                &&OPT_SKIP_HANDLER, &&OPT_LV_HANDLER, &&OPT_AND_HANDLER,
+                &&OPT_OR_HANDLER, &&OPT_MOV_HANDLER
+        };
+        NEXT();
+#else
+        for (;;) {
+        FETCH();
+        DISPATCH() {
+#endif
+
+        HANDLER(CMOV) {
+                RUN_CMOV();
+                NEXT();
+        }
+        HANDLER(SLOAD) {
+                RUN_SLOAD();
+                NEXT();
+        }
+        HANDLER(SSTORE) {
+                RUN_SSTORE();
+                NEXT();
+        }
+        HANDLER(ADD) {
+                regs[A] = regs[B] + regs[C];
+                NEXT();
+        }
+        HANDLER(MUL) {
+                regs[A] = regs[B] * regs[C];
+                NEXT();
+        }
+        HANDLER(DIV) {
+                REQUIRE(regs[C] != 0, UM_FAULT_DIVIDE);
+                regs[A] = regs[B] / regs[C];
+                NEXT();
+        }
+        HANDLER(NAND) {
+                RUN_NAND();
+                NEXT();
+        }
+        HANDLER(HALT) {
+                SAVE_STATE();
+                FINISH(UM_HALTED);
+        }
+        HANDLER(ACTIVATE) {
+                REQUIRE(wordsAfterMap(memory, regs[C]) <= limits->maxWords,
+                        UM_FAULT_MEMORY);
+                CALL_MEMORY(mapSeg);
+                NEXT();
+        }
+        HANDLER(INACTIVATE) {
+                CHECK_UNMAP(regs[C]);
+                CALL_MEMORY(unmapSeg);
+                NEXT();
+        }
+        HANDLER(OUT) {
+                REQUIRE(regs[C] < 256, UM_FAULT_OUTPUT);
+                output(io, regs[C]);
+                NEXT();
+        }
+        HANDLER(IN) {
+                WAIT_FOR_INPUT();
+                CHECKPOINT_AT_INPUT();
+                writeRequestedStats(memory, STDERR_FILENO);
+                regs[C] = input(io);
+                NEXT();
+        }
+        HANDLER(LOADP) {
+                RUN_LOADP();
+                NEXT();
+        }
+        HANDLER(LV) {
+                RUN_LV();
+                NEXT();
+        }
+
+        HANDLER(FUSED_LV_SLOAD) {
+                RUN_LV();
+                STEP();
+                RUN_SLOAD();
+                NEXT();
+        }
+        HANDLER(FUSED_LV_SSTORE) {
+                RUN_LV();
+                STEP();
+                RUN_SSTORE();
+                NEXT();
+        }
+        HANDLER(FUSED_LV_LV) {
+                RUN_LV();
+                STEP();
+                RUN_LV();
+                NEXT();
+        }
+        HANDLER(FUSED_LV_LOADP) {
+                RUN_LV();
+                STEP();
+                RUN_LOADP();
+                NEXT();
+        }
+        HANDLER(FUSED_NAND_NAND) {
+                RUN_NAND();
+                STEP();
+                RUN_NAND();
+                NEXT();
+        }
+        HANDLER(FUSED_NAND_NAND_NAND) {
+                RUN_NAND();
+                STEP();
+                RUN_NAND();
+                STEP();
+                RUN_NAND();
+                NEXT();
+        }
+        HANDLER(FUSED_LV_CMOV_LOADP) {
+                RUN_LV();
+                STEP();
+                RUN_CMOV();
+                STEP();
+                RUN_LOADP();
+                NEXT();
+        }
+
+        HANDLER(OPT_SKIP) {
+                pc += currInstruction->value - 1;
+                NEXT();
+        }
+        HANDLER(OPT_LV) {
+                RUN_LV();
+                pc += currInstruction->b;
+                NEXT();
+        }
+        HANDLER(OPT_AND) {
+                regs[A] = regs[B] & regs[C];
+                pc += currInstruction->value;
+                NEXT();
+        }
+        HANDLER(OPT_OR) {
+                regs[A] = regs[B] | regs[C];
+                pc += currInstruction->value;
+                NEXT();
+        }
+        HANDLER(OPT_MOV) {
+                regs[A] = regs[B];
+                pc += currInstruction->value;
+                NEXT();
+        }
+
+#ifdef UM_THREADED_DISPATCH
+INVALID_HANDLER:
+        NEXT();
+#else
+        default:
+                NEXT();
+        }
+        }
+#endif
+}
+
+#if !defined(UM_CHECKED_DISPATCH) && !defined(UM_LIBRARY_DISPATCH)
+/*
+ * Name: checkpointBeforeInput
+ * Purpose: Save the pending checkpoint if the input instruction about to run
+ *          would have to wait for input
+ * Parameters: The struct containing the memory structures and variables, with
+ *             the program counter at the input instruction, the machine's
+ *             I/O object
+ * Returns: None
+ * Notes: Does nothing if no checkpoint is pending or input is already
+ *        buffered. Only one checkpoint is ever saved, and failing to save it
+ *        does not stop the program
+ */
+void checkpointBeforeInput(memoryInfo memory, umIO io)
+{
+        const char *path = getCheckpointPath(memory);
+        if (path == NULL || !inputWouldBlock(io)) {
+                return;
+        }
+
+        flushOutput(io);
+        size_t outputLength;
+        const uint8_t *output = getOutputRecord(io, &outputLength);
+        if (!saveCheckpoint(memory, path, output, outputLength)) {
+                fprintf(stderr, "um: could not write checkpoint %s\n", path);
+        }
+        setCheckpointPath(memory, NULL);
+        recordOutput(io, false);
+}
+
+#elif defined(UM_CHECKED_DISPATCH)
+/*
+ * Name: runProgramChecked
+ * Purpose: Execute the program, reporting a bad segment access instead of
+ *          crashing
+ * Parameters: The struct containing the memory structures and variables, the
+ *             machine's I/O object
+ * Returns: True if the program halted, false if it made a bad segment access
+ *          or ran out of memory
+ * Notes: A load, store or program load is checked against the segment table
+ *        before it is made, so the report names the instruction, the segment
+ *        and the offset exactly, and is printed after any output the program
+ *        made. Running out of memory is reported the same way rather than
+ *        raised
+ */
+bool runProgramChecked(memoryInfo memory, umIO io)
+{
+        jmp_buf landing;
+        if (setjmp(landing) != 0) {
+                catchAllocFailures(NULL);
+                flushOutput(io);
+                fprintf(stderr, "um: instruction %u ran out of memory\n",
+                        memory->programCounter - 1);
+                return false;
+        }
+        catchAllocFailures(&landing);
+        bool halted = runCheckedLoop(memory, io);
+        catchAllocFailures(NULL);
+        return halted;
+}
+
+/*
+ * Name: printUnmapFault
+ * Purpose: Describe a bad unmap in terms of the UM program
+ * Parameters: The struct containing the memory structures and variables, the
+ *             segment ID the program tried to unmap
+ * Returns: None
+ * Notes: The program counter must be at the instruction that made it
+ */
+static void printUnmapFault(memoryInfo memory, uint32_t id)
+{
+        fprintf(stderr, "um: instruction %u unmapped segment %u, which %s\n",
+                memory->programCounter, id,
+                id == 0 ? "holds the program" : "is not mapped");
+}
+#endif
@@ -0,0 +1,39 @@
+/**************************************************************
+ *
+ *                     dispatch.h
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Interface for the UM instruction dispatch engine
+ *
+ **************************************************************/
+
+#ifndef DISPATCH_INCLUDED
+#define DISPATCH_INCLUDED
+
+#include "memory.h"
+#include "arithmetic.h"
+#include "libum.h"
+
+/*
+ * Name: runLimits
+ * Purpose: What runLimitedLoop may do, and what it did
+ * Members: budget - instructions left to run. Counts down as they retire
+ *          maxWords - the most words segments, their overhead and the
+ *                     segment table may take after a map (see wordsAfterMap)
+ *          fault - why the loop stopped if it returned UM_FAULT
+ */
+typedef struct runLimits {
+        uint64_t budget;
+        uint64_t maxWords;
+        um_fault fault;
+} runLimits;
+
+void runProgram(memoryInfo memory, umIO io);
+void checkpointBeforeInput(memoryInfo memory, umIO io);
+bool runProgramChecked(memoryInfo memory, umIO io);
+um_status runLimitedLoop(memoryInfo memory, umIO io, runLimits *limits);
+
+#endif
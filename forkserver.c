@@ -0,0 +1,231 @@
+/**************************************************************
+ *
+ *                     forkserver.c
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Implementation of the fork server behind
+ *              ./um --fork-server.
+ *
+ *              The server builds one machine and, if asked, runs it
+ *              up to the first input it would wait for, keeping what
+ *              it wrote. It then listens on a Unix socket. Every
+ *              connection gets a child made by fork, so the child's
+ *              machine is a copy-on-write copy of the server's and
+ *              shares its segment pages until it writes to them. The
+ *              connection is the child's input and output: it is
+ *              sent what the program wrote before the fork, then the
+ *              program carries on from where the server left it.
+ *
+ *              Children are not waited for. The server runs until it
+ *              is killed, and removes its socket on SIGINT and
+ *              SIGTERM.
+ *
+ **************************************************************/
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "forkserver.h"
+#include "dispatch.h"
+#include "jit.h"
+
+/* Macro Definitions */
+#define LISTEN_BACKLOG 128
+
+/* The socket the signal handler removes */
+static const char *serverSocket = NULL;
+
+/* Function Declarations */
+static void removeSocketOnSignal(int signalNumber);
+static void runChild(int connection, memoryInfo memory, umIO io,
+                     bool halted, bool useJit);
+static bool writeAll(int fd, const uint8_t *bytes, size_t length);
+
+/*
+ * Name: prewarmProgram
+ * Purpose: Run a program up to the first input it would wait for
+ * Parameters: The struct containing the memory structures and variables, an
+ *             I/O object from makeHostIO with nothing supplied, which should
+ *             be recording
+ * Returns: UM_NEEDS_INPUT with the program counter at that input, UM_HALTED
+ *          if the program never asks for input, or UM_FAULT
+ * Notes: Runs the library's command loop, so the server survives a program
+ *        that faults; the fault is reported on stderr. Memory must not be
+ *        optimized yet
+ */
+um_status prewarmProgram(memoryInfo memory, umIO io)
+{
+        runLimits limits = { UINT64_MAX, UINT64_MAX, UM_FAULT_NONE };
+        um_status status = runLimitedLoop(memory, io, &limits);
+        flushOutput(io);
+        if (status == UM_FAULT) {
+                fprintf(stderr, "um: the program faulted at instruction %u "
+                        "while warming up\n", getProgramCounter(memory));
+        }
+        return status;
+}
+
+/*
+ * Name: serveForks
+ * Purpose: Run a copy of a machine for every connection to a Unix socket
+ * Parameters: The socket's path, the struct containing the memory structures
+ *             and variables, the machine's I/O object (from makeHostIO,
+ *             recording what the program has written so far), true if the
+ *             program has already halted, true to run copies with the JIT
+ * Returns: False if the socket could not be made. Otherwise it never returns
+ * Notes: The socket must not exist yet
+ */
+bool serveForks(const char *socketPath, memoryInfo memory, umIO io,
+                bool halted, bool useJit)
+{
+        int listener = listenOnSocket(socketPath);
+        if (listener < 0) {
+                return false;
+        }
+
+        signal(SIGCHLD, SIG_IGN);
+        for (;;) {
+                int connection = accept(listener, NULL, NULL);
+                if (connection < 0) {
+                        if (errno != EINTR && errno != ECONNABORTED) {
+                                fprintf(stderr, "um: accept failed: %s\n",
+                                        strerror(errno));
+                                sleep(1);
+                        }
+                        continue;
+                }
+
+                pid_t child = fork();
+                if (child == 0) {
+                        close(listener);
+                        runChild(connection, memory, io, halted, useJit);
+                }
+                if (child < 0) {
+                        fprintf(stderr, "um: fork failed: %s\n",
+                                strerror(errno));
+                }
+                close(connection);
+        }
+}
+
+/*
+ * Name: listenOnSocket
+ * Purpose: Make a Unix socket to accept connections on
+ * Parameters: The socket's path
+ * Returns: The listening descriptor, or -1 (after reporting why on stderr)
+ * Notes: The socket must not exist yet. From here on SIGINT and SIGTERM
+ *        remove it before the process dies
+ */
+int listenOnSocket(const char *socketPath)
+{
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (strlen(socketPath) >= sizeof(address.sun_path)) {
+                fprintf(stderr, "um: socket path %s is too long\n",
+                        socketPath);
+                return -1;
+        }
+        strcpy(address.sun_path, socketPath);
+
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0 ||
+            bind(listener, (struct sockaddr *) &address,
+                 sizeof(address)) != 0 ||
+            listen(listener, LISTEN_BACKLOG) != 0) {
+                fprintf(stderr, "um: cannot listen on %s: %s\n", socketPath,
+                        strerror(errno));
+                if (listener >= 0) {
+                        close(listener);
+                }
+                return -1;
+        }
+
+        serverSocket = socketPath;
+        signal(SIGINT, removeSocketOnSignal);
+        signal(SIGTERM, removeSocketOnSignal);
+        return listener;
+}
+
+/*
+ * Name: removeSocketOnSignal
+ * Purpose: Remove the server's socket, then die of the signal
+ * Parameters: The signal number
+ * Returns: Does not return
+ * Notes: Only uses calls that are safe in a signal handler
+ */
+static void removeSocketOnSignal(int signalNumber)
+{
+        unlink(serverSocket);
+        signal(signalNumber, SIG_DFL);
+        raise(signalNumber);
+}
+
+/*
+ * Name: runChild
+ * Purpose: Run the forked copy of the machine for one connection
+ * Parameters: The connection, the struct containing the memory structures
+ *             and variables, the machine's I/O object, true if the program
+ *             has already halted, true to run it with the JIT
+ * Returns: Does not return
+ * Notes: The child exits without freeing the machine, whose pages mostly
+ *        still belong to the server
+ */
+static void runChild(int connection, memoryInfo memory, umIO io,
+                     bool halted, bool useJit)
+{
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+
+        attachIO(io, connection, connection);
+        size_t length;
+        const uint8_t *earlierOutput = getOutputRecord(io, &length);
+        if (!writeAll(connection, earlierOutput, length)) {
+                _exit(EXIT_FAILURE);
+        }
+        recordOutput(io, false);
+
+        if (!halted) {
+                if (useJit) {
+                        runProgramJit(memory, io);
+                }
+                else {
+                        runProgram(memory, io);
+                }
+        }
+        flushOutput(io);
+        _exit(EXIT_SUCCESS);
+}
+
+/*
+ * Name: writeAll
+ * Purpose: Write bytes to a file descriptor
+ * Parameters: The descriptor, the bytes, the number of bytes
+ * Returns: False if the descriptor stopped taking them
+ * Notes: None
+ */
+static bool writeAll(int fd, const uint8_t *bytes, size_t length)
+{
+        size_t written = 0;
+        while (written < length) {
+                ssize_t result = write(fd, bytes + written, length - written);
+                if (result < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (result <= 0) {
+                        return false;
+                }
+                written += result;
+        }
+        return true;
+}
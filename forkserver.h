@@ -0,0 +1,27 @@
+/**************************************************************
+ *
+ *                     forkserver.h
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Interface for serving copies of one loaded UM
+ *              machine over a Unix socket, and for making the socket
+ *
+ **************************************************************/
+
+#ifndef FORKSERVER_INCLUDED
+#define FORKSERVER_INCLUDED
+
+#include <stdbool.h>
+#include "memory.h"
+#include "arithmetic.h"
+#include "libum.h"
+
+int listenOnSocket(const char *socketPath);
+um_status prewarmProgram(memoryInfo memory, umIO io);
+bool serveForks(const char *socketPath, memoryInfo memory, umIO io,
+                bool halted, bool useJit);
+
+#endif
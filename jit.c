@@ -0,0 +1,945 @@
+/**************************************************************
+ *
+ *                     jit.c
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Implementation of a basic block compiler that turns
+ *              segment 0 into x86-64 machine code.
+ *
+ *              A block starts at whatever instruction the program
+ *              jumps to and runs until the next LOADP or HALT. The
+ *              eight UM registers live in r8d-r15d for as long as
+ *              native code is running. Arithmetic and segment loads
+ *              are emitted inline, and so are segment stores, which
+ *              only call into memory.c for segment 0 or a shared
+ *              segment. Mapping, unmapping and I/O call the normal
+ *              memory and arithmetic functions, writing back just the
+ *              registers the call reads or the C calling convention
+ *              lets it clobber.
+ *
+ *              A LOADP from segment 0 looks its target up in a table
+ *              of compiled blocks and jumps straight there, so hot
+ *              loops never leave native code. Loading a new program,
+ *              or storing into a word of segment 0 that some block
+ *              was compiled from, throws every block away. Stores
+ *              that only touch data kept in segment 0 cost nothing
+ *              extra. A program that keeps rewriting its own code is
+ *              handed to the interpreter for the rest of its run.
+ *
+ *              The code buffer is only ever writable or executable,
+ *              never both: it is made writable to compile a block and
+ *              executable again before the block runs.
+ *
+ **************************************************************/
+
+#include "jit.h"
+#include "dispatch.h"
+#include "arithmetic.h"
+#include "memcore.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED 1
+#endif
+
+#ifdef JIT_SUPPORTED
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Macro Definitions */
+#define CODE_SIZE (256u << 20)
+#define MAX_BLOCK_LENGTH 4096
+#define MAX_INSTRUCTION_BYTES 192
+#define MAX_BLOCK_BYTES ((MAX_BLOCK_LENGTH + 1) * MAX_INSTRUCTION_BYTES)
+#define MAX_FLUSHES 64
+
+/* Host register numbers */
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RBP 5
+#define RSI 6
+#define UM_REG(n) (8 + (n))
+
+/* Sets of UM registers, one bit each. r8d-r11d do not survive a C call */
+#define ALL_UM_REGS 0xFF
+#define CALLER_SAVED 0x0F
+#define REG_BIT(n) (1u << (n))
+
+/* Condition codes for jcc */
+#define CC_AE 0x3
+#define CC_A 0x7
+#define CC_Z 0x4
+#define CC_NZ 0x5
+
+/* Reasons native code hands control back to runProgramJit */
+typedef enum Jit_status {
+        JIT_HALT = 0, JIT_JUMP, JIT_RELOAD, JIT_MODIFIED, JIT_INPUT
+} Jit_status;
+
+typedef struct JitContext *JitContext;
+typedef uint32_t (*JitEntry)(JitContext ctx, void *block,
+                             memoryInfo memory);
+typedef uint32_t (*JitHelper)(JitContext ctx, uint32_t a, uint32_t b,
+                              uint32_t c);
+
+/*
+ * Name: JitContext
+ * Purpose: Everything the compiler and the compiled code share
+ * Members: blockTable - compiled code for each instruction that starts a
+ *                       block, NULL for the rest
+ *          tableLength - number of entries in blockTable
+ *          exitPc - where to resume after native code returns
+ *          memory - the UM memory being run
+ *          io - the machine's I/O object
+ *          compiled - one flag per instruction, set once the instruction
+ *                     is part of some block
+ *          version - the program version last seen by the JIT
+ *          flushes - how many times a store into compiled code dropped the
+ *                    blocks
+ *          code - start of the code buffer
+ *          codeEnd - end of the code buffer
+ *          writableBytes - how much of the start of the buffer is writable
+ *                          (and not executable) right now, or 0
+ *          cursor - where the next byte of code goes
+ *          firstBlock - where blocks start, after the shared stubs
+ *          exitStub - code that saves the registers and returns to C
+ *          jumpStub - code that jumps to the block for the pc in eax
+ *          enter - code that loads the registers and jumps to a block
+ * Notes: Compiled code addresses the first three members through rbx, so
+ *        they must stay at the front
+ */
+struct JitContext {
+        void **blockTable;
+        uint32_t tableLength;
+        uint32_t exitPc;
+        memoryInfo memory;
+        umIO io;
+        uint8_t *compiled;
+        uint32_t version;
+        uint32_t flushes;
+        uint8_t *code;
+        uint8_t *codeEnd;
+        size_t writableBytes;
+        uint8_t *cursor;
+        uint8_t *firstBlock;
+        uint8_t *exitStub;
+        uint8_t *jumpStub;
+        JitEntry enter;
+};
+
+/* Function Declarations */
+static void emitStubs(JitContext ctx);
+static void *compileBlock(JitContext ctx, uint32_t pc);
+static bool makeWritable(JitContext ctx);
+static bool makeExecutable(JitContext ctx);
+static void flushBlocks(JitContext ctx);
+static void runInput(JitContext ctx);
+static void emitInstruction(JitContext ctx, const Um_decoded *instruction,
+                            uint32_t pc);
+static void emitSegLoad(JitContext ctx, int a, int b, int c);
+static void emitSegStore(JitContext ctx, const Um_decoded *instruction,
+                         uint32_t pc);
+static void emitHelperCall(JitContext ctx, JitHelper helper,
+                           const Um_decoded *instruction, unsigned reads,
+                           unsigned writes);
+static void emitExit(JitContext ctx, uint32_t pc, Jit_status status);
+static void emitSpill(JitContext ctx, unsigned regs);
+static void emitReload(JitContext ctx, unsigned regs);
+static void emitRegReg(JitContext ctx, const uint8_t *op, int opLength,
+                       int reg, int rm);
+static void emitJump(JitContext ctx, uint8_t *target);
+static uint8_t *emitJumpForward(JitContext ctx);
+static uint8_t *emitJcc(JitContext ctx, uint8_t condition);
+static void patchJump(uint8_t *patch, uint8_t *target);
+static inline void emit8(JitContext ctx, uint8_t byte);
+static inline void emit32(JitContext ctx, uint32_t word);
+static inline void emit64(JitContext ctx, uint64_t word);
+static uint32_t helperSegStore(JitContext ctx, uint32_t a, uint32_t b,
+                               uint32_t c);
+static uint32_t helperMapSeg(JitContext ctx, uint32_t a, uint32_t b,
+                             uint32_t c);
+static uint32_t helperUnmapSeg(JitContext ctx, uint32_t a, uint32_t b,
+                               uint32_t c);
+static uint32_t helperOutput(JitContext ctx, uint32_t a, uint32_t b,
+                             uint32_t c);
+static uint32_t helperInput(JitContext ctx, uint32_t a, uint32_t b,
+                            uint32_t c);
+static uint32_t helperLoadProgram(JitContext ctx, uint32_t a, uint32_t b,
+                                  uint32_t c);
+
+/* x86 opcodes that take a register and a register/memory operand */
+static const uint8_t MOV_LOAD[] = {0x8B};
+static const uint8_t ADD_OP[] = {0x03};
+static const uint8_t AND_OP[] = {0x23};
+static const uint8_t TEST_OP[] = {0x85};
+static const uint8_t IMUL_OP[] = {0x0F, 0xAF};
+static const uint8_t CMOVNE_OP[] = {0x0F, 0x45};
+static const uint8_t GROUP3_OP[] = {0xF7};
+
+/*
+ * Name: jitSupported
+ * Purpose: Say whether this build can compile UM code
+ * Parameters: None
+ * Returns: True on x86-64 Linux
+ * Notes: None
+ */
+bool jitSupported(void)
+{
+        return true;
+}
+
+/*
+ * Name: runProgramJit
+ * Purpose: Execute the program in segment 0 until it halts, compiling it to
+ *          native code as it goes
+ * Parameters: The struct containing the memory structures and variables, the
+ *             machine's I/O object
+ * Returns: None
+ * Notes: Falls back to the interpreter if no code buffer is available or its
+ *        protection cannot be changed, if the program counter leaves
+ *        segment 0, or once the program has stored into segment 0 too many
+ *        times
+ */
+void runProgramJit(memoryInfo memory, umIO io)
+{
+        struct JitContext ctx;
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.memory = memory;
+        ctx.io = io;
+        ctx.code = mmap(NULL, CODE_SIZE, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (ctx.code == MAP_FAILED) {
+                runProgram(memory, io);
+                return;
+        }
+        ctx.codeEnd = ctx.code + CODE_SIZE;
+        ctx.cursor = ctx.code;
+        flushBlocks(&ctx);
+        bool usable = makeWritable(&ctx);
+        if (usable) {
+                emitStubs(&ctx);
+                usable = makeExecutable(&ctx);
+        }
+
+        bool halted = false;
+        while (usable && !halted) {
+                uint32_t pc = getProgramCounter(memory);
+                if (pc >= ctx.tableLength || ctx.flushes > MAX_FLUSHES) {
+                        break;
+                }
+
+                void *block = (ctx.blockTable)[pc];
+                if (block == NULL) {
+                        if (!makeWritable(&ctx)) {
+                                break;
+                        }
+                        block = compileBlock(&ctx, pc);
+                        if (!makeExecutable(&ctx)) {
+                                break;
+                        }
+                }
+                Jit_status status = ctx.enter(&ctx, block, memory);
+                setProgramCounter(memory, ctx.exitPc);
+
+                if (status == JIT_HALT) {
+                        halted = true;
+                } else if (status == JIT_MODIFIED) {
+                        (ctx.flushes)++;
+                        flushBlocks(&ctx);
+                } else if (status == JIT_RELOAD &&
+                           getProgramVersion(memory) != ctx.version) {
+                        /* A memoized load keeps the old blocks */
+                        flushBlocks(&ctx);
+                } else if (status == JIT_INPUT) {
+                        runInput(&ctx);
+                }
+        }
+
+        munmap(ctx.code, CODE_SIZE);
+        FREE(ctx.blockTable);
+        FREE(ctx.compiled);
+        if (!halted) {
+                runProgram(memory, io);
+        }
+}
+
+/*
+ * Name: runInput
+ * Purpose: Run an input instruction that native code left to this loop
+ * Parameters: The JIT context, with the program counter at the instruction
+ * Returns: None
+ * Notes: Input only leaves native code while a checkpoint is pending. Once
+ *        it has been saved, every block is compiled again with inline input
+ */
+static void runInput(JitContext ctx)
+{
+        memoryInfo memory = ctx->memory;
+        uint32_t length;
+        uint32_t pc = getProgramCounter(memory);
+        const Um_decoded *instruction = &getDecodedProgram(memory, &length)[pc];
+
+        checkpointBeforeInput(memory, ctx->io);
+        writeRequestedStats(memory, STDERR_FILENO);
+        setRegisterValue(memory, instruction->c, input(ctx->io));
+        setProgramCounter(memory, pc + 1);
+        if (getCheckpointPath(memory) == NULL) {
+                flushBlocks(ctx);
+        }
+}
+
+/*
+ * Name: flushBlocks
+ * Purpose: Throw away every compiled block and size the block table for the
+ *          current program
+ * Parameters: The JIT context
+ * Returns: None
+ * Notes: The shared stubs at the start of the code buffer are kept
+ */
+static void flushBlocks(JitContext ctx)
+{
+        uint32_t length;
+        getDecodedProgram(ctx->memory, &length);
+        if (ctx->blockTable != NULL) {
+                FREE(ctx->blockTable);
+                FREE(ctx->compiled);
+        }
+        ctx->blockTable = CALLOC(length + 1, sizeof(void *));
+        ctx->compiled = CALLOC(length + 1, sizeof(uint8_t));
+        ctx->tableLength = length;
+        ctx->version = getProgramVersion(ctx->memory);
+        if (ctx->firstBlock != NULL) {
+                ctx->cursor = ctx->firstBlock;
+        }
+}
+
+/*
+ * Name: emitStubs
+ * Purpose: Emit the code shared by every block: the entry trampoline, the
+ *          exit stub and the dynamic jump stub
+ * Parameters: The JIT context
+ * Returns: None
+ * Notes: While native code runs rbx holds the context, rbp the UM memory
+ *        and the stack is 16 byte aligned for helper calls
+ */
+static void emitStubs(JitContext ctx)
+{
+        static const uint8_t prologue[] = {
+                0x53,                   /* push rbx */
+                0x55,                   /* push rbp */
+                0x41, 0x54,             /* push r12 */
+                0x41, 0x55,             /* push r13 */
+                0x41, 0x56,             /* push r14 */
+                0x41, 0x57,             /* push r15 */
+                0x48, 0x83, 0xEC, 0x08, /* sub rsp, 8 */
+                0x48, 0x89, 0xFB,       /* mov rbx, rdi */
+                0x48, 0x89, 0xD5        /* mov rbp, rdx */
+        };
+
+        /* Native code reaches the registers with 8-bit displacements */
+        assert(offsetof(struct memoryInfo, allRegs) +
+               sizeof(((struct memoryInfo *) NULL)->allRegs) <= 0x80);
+        static const uint8_t epilogue[] = {
+                0x48, 0x83, 0xC4, 0x08, /* add rsp, 8 */
+                0x41, 0x5F,             /* pop r15 */
+                0x41, 0x5E,             /* pop r14 */
+                0x41, 0x5D,             /* pop r13 */
+                0x41, 0x5C,             /* pop r12 */
+                0x5D,                   /* pop rbp */
+                0x5B,                   /* pop rbx */
+                0xC3                    /* ret */
+        };
+        static const uint8_t lookup[] = {
+                0x48, 0x8B, 0x53,       /* mov rdx, [rbx + blockTable] */
+                offsetof(struct JitContext, blockTable),
+                0x48, 0x8B, 0x14, 0xC2, /* mov rdx, [rdx + rax * 8] */
+                0x48, 0x85, 0xD2        /* test rdx, rdx */
+        };
+
+        /* enter(ctx, block, memory): load the registers and run the block */
+        union { uint8_t *code; JitEntry entry; } entry = { ctx->cursor };
+        ctx->enter = entry.entry;
+        memcpy(ctx->cursor, prologue, sizeof(prologue));
+        ctx->cursor += sizeof(prologue);
+        emitReload(ctx, ALL_UM_REGS);
+        emit8(ctx, 0xFF);               /* jmp rsi */
+        emit8(ctx, 0xE6);
+
+        /* Exit with the status in eax and the pc to resume at in esi */
+        ctx->exitStub = ctx->cursor;
+        emitSpill(ctx, ALL_UM_REGS);
+        emit8(ctx, 0x89);               /* mov [rbx + exitPc], esi */
+        emit8(ctx, 0x73);
+        emit8(ctx, offsetof(struct JitContext, exitPc));
+        memcpy(ctx->cursor, epilogue, sizeof(epilogue));
+        ctx->cursor += sizeof(epilogue);
+
+        /* Jump to the compiled block for the pc in eax, or exit to C */
+        ctx->jumpStub = ctx->cursor;
+        emit8(ctx, 0x3B);               /* cmp eax, [rbx + tableLength] */
+        emit8(ctx, 0x43);
+        emit8(ctx, offsetof(struct JitContext, tableLength));
+        uint8_t *outOfRange = emitJcc(ctx, CC_AE);
+        memcpy(ctx->cursor, lookup, sizeof(lookup));
+        ctx->cursor += sizeof(lookup);
+        uint8_t *notCompiled = emitJcc(ctx, CC_Z);
+        emit8(ctx, 0xFF);               /* jmp rdx */
+        emit8(ctx, 0xE2);
+        patchJump(outOfRange, ctx->cursor);
+        patchJump(notCompiled, ctx->cursor);
+        emit8(ctx, 0x89);               /* mov esi, eax */
+        emit8(ctx, 0xC6);
+        emit8(ctx, 0xB8);               /* mov eax, JIT_JUMP */
+        emit32(ctx, JIT_JUMP);
+        emitJump(ctx, ctx->exitStub);
+
+        ctx->firstBlock = ctx->cursor;
+}
+
+/*
+ * Name: compileBlock
+ * Purpose: Compile the block that starts at the given instruction
+ * Parameters: The JIT context, the index of the block's first instruction
+ * Returns: The block's native code
+ * Notes: If the code buffer fills up every block is thrown away and the
+ *        block is compiled again into the empty buffer
+ */
+static void *compileBlock(JitContext ctx, uint32_t pc)
+{
+        uint32_t length;
+        const Um_decoded *program = getDecodedProgram(ctx->memory, &length);
+        uint32_t startPc = pc;
+        uint8_t *start = ctx->cursor;
+
+        for (uint32_t count = 0; ; count++, pc++) {
+                if (ctx->codeEnd - ctx->cursor < MAX_INSTRUCTION_BYTES) {
+                        flushBlocks(ctx);
+                        return compileBlock(ctx, startPc);
+                }
+                if (pc >= length) {
+                        emitExit(ctx, pc, JIT_JUMP);
+                        break;
+                }
+                if (count == MAX_BLOCK_LENGTH) {
+                        emit8(ctx, 0xB8);       /* mov eax, pc */
+                        emit32(ctx, pc);
+                        emitJump(ctx, ctx->jumpStub);
+                        break;
+                }
+
+                Um_opcode opcode = baseOpcode(program[pc].opcode);
+                (ctx->compiled)[pc] = 1;
+                emitInstruction(ctx, &program[pc], pc);
+                if (opcode == HALT || opcode == LOADP) {
+                        break;
+                }
+        }
+
+        (ctx->blockTable)[startPc] = start;
+        return start;
+}
+
+/*
+ * Name: makeWritable
+ * Purpose: Let the compiler write the next block into the code buffer
+ * Parameters: The JIT context
+ * Returns: False if the protection could not be changed
+ * Notes: Everything from the start of the buffer to MAX_BLOCK_BYTES past the
+ *        cursor becomes writable and stops being executable, which covers
+ *        the block even if compileBlock has to start over at firstBlock
+ */
+static bool makeWritable(JitContext ctx)
+{
+        size_t pageSize = sysconf(_SC_PAGESIZE);
+        size_t nbytes = (ctx->cursor - ctx->code) + MAX_BLOCK_BYTES;
+        nbytes = (nbytes + pageSize - 1) & ~(pageSize - 1);
+        if (nbytes > CODE_SIZE) {
+                nbytes = CODE_SIZE;
+        }
+        if (mprotect(ctx->code, nbytes, PROT_READ | PROT_WRITE) != 0) {
+                return false;
+        }
+        ctx->writableBytes = nbytes;
+        return true;
+}
+
+/*
+ * Name: makeExecutable
+ * Purpose: Let the code just written run, and stop it being written
+ * Parameters: The JIT context, after makeWritable
+ * Returns: False if the protection could not be changed
+ * Notes: None
+ */
+static bool makeExecutable(JitContext ctx)
+{
+        if (mprotect(ctx->code, ctx->writableBytes,
+                     PROT_READ | PROT_EXEC) != 0) {
+                return false;
+        }
+        ctx->writableBytes = 0;
+        return true;
+}
+
+/*
+ * Name: emitInstruction
+ * Purpose: Emit native code for one UM instruction
+ * Parameters: The JIT context, the unpacked instruction, its index
+ * Returns: None
+ * Notes: Opcodes 14 and 15 emit nothing, matching the interpreter
+ */
+static void emitInstruction(JitContext ctx, const Um_decoded *instruction,
+                            uint32_t pc)
+{
+        int a = UM_REG(instruction->a);
+        int b = UM_REG(instruction->b);
+        int c = UM_REG(instruction->c);
+        uint8_t *patch;
+
+        switch (baseOpcode(instruction->opcode)) {
+        case CMOV:
+                emitRegReg(ctx, TEST_OP, 1, c, c);
+                emitRegReg(ctx, CMOVNE_OP, 2, a, b);
+                break;
+        case SLOAD:
+                emitSegLoad(ctx, a, b, c);
+                break;
+        case SSTORE:
+                emitSegStore(ctx, instruction, pc);
+                break;
+        case ADD:
+                emitRegReg(ctx, MOV_LOAD, 1, RAX, b);
+                emitRegReg(ctx, ADD_OP, 1, RAX, c);
+                emitRegReg(ctx, MOV_LOAD, 1, a, RAX);
+                break;
+        case MUL:
+                emitRegReg(ctx, MOV_LOAD, 1, RAX, b);
+                emitRegReg(ctx, IMUL_OP, 2, RAX, c);
+                emitRegReg(ctx, MOV_LOAD, 1, a, RAX);
+                break;
+        case DIV:
+                emitRegReg(ctx, MOV_LOAD, 1, RAX, b);
+                emit8(ctx, 0x31);               /* xor edx, edx */
+                emit8(ctx, 0xD2);
+                emitRegReg(ctx, GROUP3_OP, 1, 6, c);    /* div c */
+                emitRegReg(ctx, MOV_LOAD, 1, a, RAX);
+                break;
+        case NAND:
+                emitRegReg(ctx, MOV_LOAD, 1, RAX, b);
+                emitRegReg(ctx, AND_OP, 1, RAX, c);
+                emitRegReg(ctx, GROUP3_OP, 1, 2, RAX);  /* not eax */
+                emitRegReg(ctx, MOV_LOAD, 1, a, RAX);
+                break;
+        case HALT:
+                emitExit(ctx, pc + 1, JIT_HALT);
+                break;
+        case ACTIVATE:
+                emitHelperCall(ctx, helperMapSeg, instruction,
+                               REG_BIT(instruction->c),
+                               REG_BIT(instruction->b));
+                break;
+        case INACTIVATE:
+                emitHelperCall(ctx, helperUnmapSeg, instruction,
+                               REG_BIT(instruction->c), 0);
+                break;
+        case OUT:
+                emitHelperCall(ctx, helperOutput, instruction,
+                               REG_BIT(instruction->c), 0);
+                break;
+        case IN:
+                /* A pending checkpoint needs the interpreter's view */
+                if (getCheckpointPath(ctx->memory) != NULL) {
+                        emitExit(ctx, pc, JIT_INPUT);
+                }
+                else {
+                        emitHelperCall(ctx, helperInput, instruction, 0,
+                                       REG_BIT(instruction->c));
+                }
+                break;
+        case LOADP:
+                /* A jump within segment 0 goes through the jump stub */
+                emitRegReg(ctx, TEST_OP, 1, b, b);
+                patch = emitJcc(ctx, CC_NZ);
+                emitRegReg(ctx, MOV_LOAD, 1, RAX, c);
+                emitJump(ctx, ctx->jumpStub);
+
+                /* Anything else replaces the program */
+                patchJump(patch, ctx->cursor);
+                emitHelperCall(ctx, helperLoadProgram, instruction,
+                               REG_BIT(instruction->b) |
+                               REG_BIT(instruction->c), 0);
+                emit8(ctx, 0x89);               /* mov esi, eax */
+                emit8(ctx, 0xC6);
+                emit8(ctx, 0xB8);               /* mov eax, JIT_RELOAD */
+                emit32(ctx, JIT_RELOAD);
+                emitJump(ctx, ctx->exitStub);
+                break;
+        case LV:
+                emit8(ctx, 0x41);               /* mov a, value */
+                emit8(ctx, 0xB8 + (a & 7));
+                emit32(ctx, instruction->value);
+                break;
+        default:
+                break;
+        }
+}
+
+/*
+ * Name: emitSegLoad
+ * Purpose: Emit a segment load straight from the segment table
+ * Parameters: The JIT context, the host registers holding the instruction's
+ *             A, B and C
+ * Returns: None
+ * Notes: Like the interpreter, trusts the program to load from a mapped
+ *        segment within its length
+ */
+static void emitSegLoad(JitContext ctx, int a, int b, int c)
+{
+        emit8(ctx, 0x48);               /* mov rax, [rbp + segments] */
+        emit8(ctx, 0x8B);
+        emit8(ctx, 0x45);
+        emit8(ctx, offsetof(struct memoryInfo, segments));
+        emitRegReg(ctx, MOV_LOAD, 1, RDX, b);
+        emit8(ctx, 0x48);               /* mov rax, [rax + rdx * 8] */
+        emit8(ctx, 0x8B);
+        emit8(ctx, 0x04);
+        emit8(ctx, 0xD0);
+        emitRegReg(ctx, MOV_LOAD, 1, RDX, c);
+        emit8(ctx, 0x44);               /* mov a, [rax + rdx * 4 + segData] */
+        emit8(ctx, 0x8B);
+        emit8(ctx, 0x44 | ((a & 7) << 3));
+        emit8(ctx, 0x90);
+        emit8(ctx, offsetof(struct segmentInfo, segData));
+}
+
+/*
+ * Name: emitSegStore
+ * Purpose: Emit a segment store straight into the segment table
+ * Parameters: The JIT context, the unpacked instruction, its index
+ * Returns: None
+ * Notes: Stores into segment 0 or into a shared segment call helperSegStore
+ *        instead, as storeWord calls storeWordSlow, and leave the block if
+ *        the store changed code some block was compiled from
+ */
+static void emitSegStore(JitContext ctx, const Um_decoded *instruction,
+                         uint32_t pc)
+{
+        int a = UM_REG(instruction->a);
+        int b = UM_REG(instruction->b);
+        int c = UM_REG(instruction->c);
+
+        emitRegReg(ctx, MOV_LOAD, 1, RDX, a);
+        emitRegReg(ctx, TEST_OP, 1, RDX, RDX);
+        uint8_t *programSegment = emitJcc(ctx, CC_Z);
+        emit8(ctx, 0x48);               /* mov rax, [rbp + segments] */
+        emit8(ctx, 0x8B);
+        emit8(ctx, 0x45);
+        emit8(ctx, offsetof(struct memoryInfo, segments));
+        emit8(ctx, 0x48);               /* mov rax, [rax + rdx * 8] */
+        emit8(ctx, 0x8B);
+        emit8(ctx, 0x04);
+        emit8(ctx, 0xD0);
+        emit8(ctx, 0x83);               /* cmp dword [rax + refCount], 1 */
+        emit8(ctx, 0x78);
+        emit8(ctx, offsetof(struct segmentInfo, refCount));
+        emit8(ctx, 0x01);
+        uint8_t *shared = emitJcc(ctx, CC_A);
+        emitRegReg(ctx, MOV_LOAD, 1, RDX, b);
+        emit8(ctx, 0x44);               /* mov [rax + rdx * 4 + segData], c */
+        emit8(ctx, 0x89);
+        emit8(ctx, 0x44 | ((c & 7) << 3));
+        emit8(ctx, 0x90);
+        emit8(ctx, offsetof(struct segmentInfo, segData));
+        uint8_t *stored = emitJumpForward(ctx);
+
+        patchJump(programSegment, ctx->cursor);
+        patchJump(shared, ctx->cursor);
+        emitHelperCall(ctx, helperSegStore, instruction,
+                       REG_BIT(instruction->a) | REG_BIT(instruction->b) |
+                       REG_BIT(instruction->c), 0);
+        emitRegReg(ctx, TEST_OP, 1, RAX, RAX);
+        uint8_t *unchanged = emitJcc(ctx, CC_Z);
+        emitExit(ctx, pc + 1, JIT_MODIFIED);
+        patchJump(stored, ctx->cursor);
+        patchJump(unchanged, ctx->cursor);
+}
+
+/*
+ * Name: emitHelperCall
+ * Purpose: Emit a call to a C helper that carries out one instruction
+ * Parameters: The JIT context, the helper, the unpacked instruction, the UM
+ *             registers the helper reads and the ones it writes, as sets of
+ *             REG_BIT
+ * Returns: None
+ * Notes: Only the registers the helper reads, and the ones in r8d-r11d that
+ *        the call may clobber, are written back before the call. Those and
+ *        the ones the helper writes are reloaded after it; r12d-r15d keep
+ *        their values across the call. The helper's return value is left in
+ *        eax
+ */
+static void emitHelperCall(JitContext ctx, JitHelper helper,
+                           const Um_decoded *instruction, unsigned reads,
+                           unsigned writes)
+{
+        emitSpill(ctx, CALLER_SAVED | reads);
+        emit8(ctx, 0x48);               /* mov rdi, rbx */
+        emit8(ctx, 0x89);
+        emit8(ctx, 0xDF);
+        emit8(ctx, 0xBE);               /* mov esi, a */
+        emit32(ctx, instruction->a);
+        emit8(ctx, 0xBA);               /* mov edx, b */
+        emit32(ctx, instruction->b);
+        emit8(ctx, 0xB9);               /* mov ecx, c */
+        emit32(ctx, instruction->c);
+        emit8(ctx, 0x48);               /* mov rax, helper */
+        emit8(ctx, 0xB8);
+        emit64(ctx, (uint64_t) (uintptr_t) helper);
+        emit8(ctx, 0xFF);               /* call rax */
+        emit8(ctx, 0xD0);
+        emitReload(ctx, CALLER_SAVED | writes);
+}
+
+/*
+ * Name: emitExit
+ * Purpose: Emit a return to runProgramJit
+ * Parameters: The JIT context, the pc to resume at, the reason for leaving
+ * Returns: None
+ * Notes: None
+ */
+static void emitExit(JitContext ctx, uint32_t pc, Jit_status status)
+{
+        emit8(ctx, 0xBE);               /* mov esi, pc */
+        emit32(ctx, pc);
+        emit8(ctx, 0xB8);               /* mov eax, status */
+        emit32(ctx, status);
+        emitJump(ctx, ctx->exitStub);
+}
+
+/*
+ * Name: emitSpill
+ * Purpose: Emit code to write UM registers back to the register file
+ * Parameters: The JIT context, the registers to write as a set of REG_BIT
+ * Returns: None
+ * Notes: None
+ */
+static void emitSpill(JitContext ctx, unsigned regs)
+{
+        for (int i = 0; i < NUM_REGS; i++) {
+                if (!(regs & REG_BIT(i))) {
+                        continue;
+                }
+                emit8(ctx, 0x44);       /* mov [rbp + allRegs + 4 * i], */
+                emit8(ctx, 0x89);       /*     r(8 + i)d */
+                emit8(ctx, 0x40 | (i << 3) | RBP);
+                emit8(ctx, offsetof(struct memoryInfo, allRegs) + 4 * i);
+        }
+}
+
+/*
+ * Name: emitReload
+ * Purpose: Emit code to load UM registers from the register file
+ * Parameters: The JIT context, the registers to load as a set of REG_BIT
+ * Returns: None
+ * Notes: None
+ */
+static void emitReload(JitContext ctx, unsigned regs)
+{
+        for (int i = 0; i < NUM_REGS; i++) {
+                if (!(regs & REG_BIT(i))) {
+                        continue;
+                }
+                emit8(ctx, 0x44);       /* mov r(8 + i)d, */
+                emit8(ctx, 0x8B);       /*     [rbp + allRegs + 4 * i] */
+                emit8(ctx, 0x40 | (i << 3) | RBP);
+                emit8(ctx, offsetof(struct memoryInfo, allRegs) + 4 * i);
+        }
+}
+
+/*
+ * Name: emitRegReg
+ * Purpose: Emit a 32-bit instruction between two registers
+ * Parameters: The JIT context, the opcode bytes and their count, the register
+ *             for the ModRM reg field, the register for the ModRM rm field
+ * Returns: None
+ * Notes: Adds a REX prefix when either register is r8-r15
+ */
+static void emitRegReg(JitContext ctx, const uint8_t *op, int opLength,
+                       int reg, int rm)
+{
+        uint8_t rex = 0x40 | ((reg >> 3) << 2) | (rm >> 3);
+        if (rex != 0x40) {
+                emit8(ctx, rex);
+        }
+        for (int i = 0; i < opLength; i++) {
+                emit8(ctx, op[i]);
+        }
+        emit8(ctx, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/*
+ * Name: emitJump
+ * Purpose: Emit an unconditional jump
+ * Parameters: The JIT context, the jump target
+ * Returns: None
+ * Notes: None
+ */
+static void emitJump(JitContext ctx, uint8_t *target)
+{
+        emit8(ctx, 0xE9);
+        emit32(ctx, (uint32_t) (target - (ctx->cursor + 4)));
+}
+
+/*
+ * Name: emitJumpForward
+ * Purpose: Emit an unconditional jump whose target is not known yet
+ * Parameters: The JIT context
+ * Returns: The location to hand to patchJump once the target is known
+ * Notes: None
+ */
+static uint8_t *emitJumpForward(JitContext ctx)
+{
+        emit8(ctx, 0xE9);
+        uint8_t *patch = ctx->cursor;
+        emit32(ctx, 0);
+        return patch;
+}
+
+/*
+ * Name: emitJcc
+ * Purpose: Emit a conditional jump whose target is not known yet
+ * Parameters: The JIT context, the condition code
+ * Returns: The location to hand to patchJump once the target is known
+ * Notes: None
+ */
+static uint8_t *emitJcc(JitContext ctx, uint8_t condition)
+{
+        emit8(ctx, 0x0F);
+        emit8(ctx, 0x80 | condition);
+        uint8_t *patch = ctx->cursor;
+        emit32(ctx, 0);
+        return patch;
+}
+
+/*
+ * Name: patchJump
+ * Purpose: Point a jump emitted by emitJcc at its target
+ * Parameters: The location returned by emitJcc, the jump target
+ * Returns: None
+ * Notes: None
+ */
+static void patchJump(uint8_t *patch, uint8_t *target)
+{
+        uint32_t offset = (uint32_t) (target - (patch + 4));
+        memcpy(patch, &offset, sizeof(offset));
+}
+
+static inline void emit8(JitContext ctx, uint8_t byte)
+{
+        *(ctx->cursor)++ = byte;
+}
+
+static inline void emit32(JitContext ctx, uint32_t word)
+{
+        memcpy(ctx->cursor, &word, sizeof(word));
+        ctx->cursor += sizeof(word);
+}
+
+static inline void emit64(JitContext ctx, uint64_t word)
+{
+        memcpy(ctx->cursor, &word, sizeof(word));
+        ctx->cursor += sizeof(word);
+}
+
+/*
+ * Helpers called from native code. Each gets the register numbers of its
+ * instruction, runs it against the register file and returns non-zero when
+ * native code has to leave its block. Only the registers emitHelperCall was
+ * told a helper reads are up to date in the register file.
+ */
+
+/* Only a store into a word some block was compiled from forces an exit */
+static uint32_t helperSegStore(JitContext ctx, uint32_t a, uint32_t b,
+                               uint32_t c)
+{
+        uint32_t regsInCommand[3] = {a, b, c};
+        segStore(regsInCommand, ctx->memory);
+        if (getProgramVersion(ctx->memory) == ctx->version) {
+                return 0;
+        }
+
+        ctx->version = getProgramVersion(ctx->memory);
+        uint32_t offset = getRegisterValue(ctx->memory, b);
+        return offset < ctx->tableLength && (ctx->compiled)[offset];
+}
+
+static uint32_t helperMapSeg(JitContext ctx, uint32_t a, uint32_t b,
+                             uint32_t c)
+{
+        uint32_t regsInCommand[3] = {a, b, c};
+        mapSeg(regsInCommand, ctx->memory);
+        writeRequestedStats(ctx->memory, STDERR_FILENO);
+        return 0;
+}
+
+static uint32_t helperUnmapSeg(JitContext ctx, uint32_t a, uint32_t b,
+                               uint32_t c)
+{
+        uint32_t regsInCommand[3] = {a, b, c};
+        unmapSeg(regsInCommand, ctx->memory);
+        writeRequestedStats(ctx->memory, STDERR_FILENO);
+        return 0;
+}
+
+static uint32_t helperOutput(JitContext ctx, uint32_t a, uint32_t b,
+                             uint32_t c)
+{
+        (void) a;
+        (void) b;
+        output(ctx->io, getRegisterValue(ctx->memory, c));
+        return 0;
+}
+
+static uint32_t helperInput(JitContext ctx, uint32_t a, uint32_t b,
+                            uint32_t c)
+{
+        (void) a;
+        (void) b;
+        writeRequestedStats(ctx->memory, STDERR_FILENO);
+        setRegisterValue(ctx->memory, c, input(ctx->io));
+        return 0;
+}
+
+/* Returns the new program counter rather than a flag */
+static uint32_t helperLoadProgram(JitContext ctx, uint32_t a, uint32_t b,
+                                  uint32_t c)
+{
+        uint32_t regsInCommand[3] = {a, b, c};
+        loadProgram(regsInCommand, ctx->memory);
+        writeRequestedStats(ctx->memory, STDERR_FILENO);
+        return getProgramCounter(ctx->memory);
+}
+
+#else
+
+/*
+ * Without an x86-64 host there is nothing to compile to, so the JIT is just
+ * the interpreter
+ */
+
+bool jitSupported(void)
+{
+        return false;
+}
+
+void runProgramJit(memoryInfo memory, umIO io)
+{
+        runProgram(memory, io);
+}
+
+#endif
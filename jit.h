@@ -0,0 +1,23 @@
+/**************************************************************
+ *
+ *                     jit.h
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Interface for the x86-64 basic block compiler
+ *
+ **************************************************************/
+
+#ifndef JIT_INCLUDED
+#define JIT_INCLUDED
+
+#include <stdbool.h>
+#include "memory.h"
+#include "arithmetic.h"
+
+bool jitSupported(void);
+void runProgramJit(memoryInfo memory, umIO io);
+
+#endif
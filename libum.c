@@ -0,0 +1,236 @@
+/**************************************************************
+ *
+ *                     libum.c
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Implementation of the embedding interface in
+ *              libum.h.
+ *
+ *              A machine is the same memory and I/O object the um
+ *              executable builds, run by runLimitedLoop, the command
+ *              loop built with every check the host needs. Output
+ *              goes straight from the I/O buffer to the host's
+ *              function, and supplied input is read where the host
+ *              keeps it. Once a machine halts or faults, um_run only
+ *              says so again.
+ *
+ *              Memory the program needs that cannot be allocated is a
+ *              UM_FAULT_MEMORY fault too: um_run catches the failure
+ *              on its own thread (see catchAllocFailures), so the host
+ *              never sees Mem_Failed. um_create catches it the same
+ *              way and returns NULL.
+ *
+ **************************************************************/
+
+#include <setjmp.h>
+#include <stdlib.h>
+#include "libum.h"
+#include "memory.h"
+#include "arithmetic.h"
+#include "dispatch.h"
+#include "segpool.h"
+
+/*
+ * Name: um_vm
+ * Purpose: One embedded machine
+ * Members: memory - the machine's memory, registers and program counter
+ *          io - the machine's I/O object, fed by the host
+ *          maxWords - the memory limit, see um_set_memory_limit
+ *          instructions - how many instructions have run
+ *          finished - true once the program has halted or faulted
+ *          status - why the last um_run came back
+ *          fault - what the fault was, if the program faulted
+ */
+struct um_vm {
+        memoryInfo memory;
+        umIO io;
+        uint64_t maxWords;
+        uint64_t instructions;
+        bool finished;
+        um_status status;
+        um_fault fault;
+};
+
+/*
+ * Name: um_create
+ * Purpose: Make a machine ready to run a program
+ * Parameters: The program's bytes, as they would be in a .um file, the
+ *             number of bytes, the function to give output to (NULL to drop
+ *             it) and a pointer to pass that function
+ * Returns: The machine, or NULL if the length is not a whole number of words,
+ *          the program alone is over UM_DEFAULT_MAX_WORDS or memory for it
+ *          cannot be allocated
+ * Notes: The bytes are copied, so the host may release them once this
+ *        returns. The machine has no input until um_supply_input
+ */
+um_vm *um_create(const uint8_t *program, size_t length,
+                 um_output_fn output, void *context)
+{
+        if (length % sizeof(uint32_t) != 0 ||
+            length / sizeof(uint32_t) > UM_DEFAULT_MAX_WORDS) {
+                return NULL;
+        }
+
+        /* makeMemoryInfo frees what it made before failing again here */
+        um_vm *volatile vm = NULL;
+        jmp_buf landing;
+        if (setjmp(landing) != 0) {
+                catchAllocFailures(NULL);
+                free(vm);
+                return NULL;
+        }
+        catchAllocFailures(&landing);
+        vm = allocOrFail(1, sizeof(struct um_vm));
+        vm->memory = makeMemoryInfo(program, length / sizeof(uint32_t));
+        catchAllocFailures(NULL);
+        vm->io = makeHostIO(output, context);
+        vm->maxWords = UM_DEFAULT_MAX_WORDS;
+        vm->status = UM_BUDGET_EXHAUSTED;
+        vm->fault = UM_FAULT_NONE;
+        return vm;
+}
+
+/*
+ * Name: um_destroy
+ * Purpose: Free a machine
+ * Parameters: The machine, or NULL
+ * Returns: None
+ * Notes: Output not yet flushed is dropped; um_run flushes before it returns
+ */
+void um_destroy(um_vm *vm)
+{
+        if (vm == NULL) {
+                return;
+        }
+        freeIO(vm->io);
+        freeMemory(vm->memory);
+        free(vm);
+}
+
+/*
+ * Name: um_run
+ * Purpose: Run a machine for at most a number of instructions
+ * Parameters: The machine, the most instructions to run
+ * Returns: UM_HALTED, UM_BUDGET_EXHAUSTED, UM_NEEDS_INPUT after running
+ *          every instruction before an input no bytes are supplied for, or
+ *          UM_FAULT (see um_last_fault)
+ * Notes: All output is given to the output function before this returns.
+ *        A machine that stopped for any reason but halting or a fault
+ *        carries on where it stopped. If an allocation fails, the
+ *        instructions run in this call are not counted
+ */
+um_status um_run(um_vm *vm, uint64_t max_instructions)
+{
+        if (vm->finished) {
+                return vm->status;
+        }
+
+        jmp_buf landing;
+        if (setjmp(landing) != 0) {
+                catchAllocFailures(NULL);
+                vm->status = UM_FAULT;
+                vm->fault = UM_FAULT_MEMORY;
+                vm->finished = true;
+                flushOutput(vm->io);
+                return vm->status;
+        }
+        catchAllocFailures(&landing);
+        runLimits limits = { max_instructions, vm->maxWords, UM_FAULT_NONE };
+        um_status status = runLimitedLoop(vm->memory, vm->io, &limits);
+        catchAllocFailures(NULL);
+
+        vm->status = status;
+        vm->instructions += max_instructions - limits.budget;
+        vm->fault = limits.fault;
+        vm->finished = vm->status == UM_HALTED || vm->status == UM_FAULT;
+        flushOutput(vm->io);
+        return vm->status;
+}
+
+/*
+ * Name: um_supply_input
+ * Purpose: Give a machine the input its program reads next
+ * Parameters: The machine, the bytes, the number of bytes
+ * Returns: False, and supplies nothing, if bytes supplied earlier have not
+ *          all been read or the input has been ended
+ * Notes: The bytes are read where they are, so they must stay put until
+ *        um_run returns UM_NEEDS_INPUT again or the machine is destroyed
+ */
+bool um_supply_input(um_vm *vm, const uint8_t *bytes, size_t length)
+{
+        if (!inputWouldBlock(vm->io)) {
+                return false;
+        }
+        supplyInput(vm->io, bytes, length);
+        return true;
+}
+
+/*
+ * Name: um_end_input
+ * Purpose: Say that no more input is coming
+ * Parameters: The machine
+ * Returns: None
+ * Notes: Once what was supplied has been read, every input instruction gets
+ *        end of input (all 1s) instead of making um_run return
+ *        UM_NEEDS_INPUT
+ */
+void um_end_input(um_vm *vm)
+{
+        endInput(vm->io);
+}
+
+/*
+ * Name: um_set_memory_limit
+ * Purpose: Limit how much memory a machine's program may map
+ * Parameters: The machine, the most words all its segments may hold at once
+ * Returns: None
+ * Notes: A map that would go past the limit is a UM_FAULT_MEMORY fault. Every
+ *        segment also counts a few words of overhead, and the segment table
+ *        counts too, so mapping empty segments cannot get around it. The
+ *        default is UM_DEFAULT_MAX_WORDS (1 GB)
+ */
+void um_set_memory_limit(um_vm *vm, uint64_t max_words)
+{
+        vm->maxWords = max_words;
+}
+
+/*
+ * Name: um_last_fault
+ * Purpose: Say what a machine's program did wrong
+ * Parameters: The machine
+ * Returns: The fault, or UM_FAULT_NONE if the last um_run did not fault
+ * Notes: None
+ */
+um_fault um_last_fault(const um_vm *vm)
+{
+        return vm->fault;
+}
+
+/*
+ * Name: um_program_counter
+ * Purpose: Get where a machine stopped
+ * Parameters: The machine
+ * Returns: The index in segment 0 of the next instruction to run. After a
+ *          fault, the instruction that faulted; after halting, the one after
+ *          the halt
+ * Notes: None
+ */
+uint32_t um_program_counter(const um_vm *vm)
+{
+        return getProgramCounter(vm->memory);
+}
+
+/*
+ * Name: um_instructions_run
+ * Purpose: Get how much of its budgets a machine has used
+ * Parameters: The machine
+ * Returns: The number of instructions run over every um_run
+ * Notes: Instructions that faulted or waited for input are not counted
+ */
+uint64_t um_instructions_run(const um_vm *vm)
+{
+        return vm->instructions;
+}
@@ -0,0 +1,76 @@
+/**************************************************************
+ *
+ *                     libum.h
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Interface for running UM machines inside another
+ *              program. Link with libum.a.
+ *
+ *              A machine is made from a program already in memory
+ *              and run a number of instructions at a time. um_run
+ *              comes back when the program halts, when the budget is
+ *              used up, when the program wants input nobody has
+ *              supplied yet, or when it does something that would
+ *              crash the UM (a fault). Output is handed to a function
+ *              the host gives; input is read in place from bytes the
+ *              host supplies. Nothing the program does stops the host
+ *              process. Each machine is separate, so different
+ *              threads may run different machines.
+ *
+ **************************************************************/
+
+#ifndef LIBUM_INCLUDED
+#define LIBUM_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Words segments may hold at once unless um_set_memory_limit says */
+#define UM_DEFAULT_MAX_WORDS ((uint64_t) 1 << 28)
+
+typedef struct um_vm um_vm;
+
+/* Why um_run came back */
+typedef enum um_status {
+        UM_HALTED = 0, UM_BUDGET_EXHAUSTED, UM_NEEDS_INPUT, UM_FAULT
+} um_status;
+
+/* What the program did wrong, for UM_FAULT */
+typedef enum um_fault {
+        UM_FAULT_NONE = 0,
+        UM_FAULT_SEGMENT,       /* load, store or LOADP of a bad segment */
+        UM_FAULT_UNMAP,         /* unmap of segment 0 or an unused ID */
+        UM_FAULT_PROGRAM_END,   /* ran or jumped past the end of the program */
+        UM_FAULT_DIVIDE,        /* division by zero */
+        UM_FAULT_OUTPUT,        /* output of a value over 255 */
+        UM_FAULT_MEMORY         /* map past the memory limit, or out of
+                                   memory */
+} um_fault;
+
+/*
+ * Called with output as it is flushed. The bytes are only valid for the call
+ */
+typedef void (*um_output_fn)(void *context, const uint8_t *bytes,
+                             size_t length);
+
+/*
+ * um_create returns NULL if the length is not a whole number of words, if the
+ * program alone is over UM_DEFAULT_MAX_WORDS, or if memory for it cannot be
+ * allocated
+ */
+um_vm *um_create(const uint8_t *program, size_t length,
+                 um_output_fn output, void *context);
+void um_destroy(um_vm *vm);
+um_status um_run(um_vm *vm, uint64_t max_instructions);
+bool um_supply_input(um_vm *vm, const uint8_t *bytes, size_t length);
+void um_end_input(um_vm *vm);
+void um_set_memory_limit(um_vm *vm, uint64_t max_words);
+um_fault um_last_fault(const um_vm *vm);
+uint32_t um_program_counter(const um_vm *vm);
+uint64_t um_instructions_run(const um_vm *vm);
+
+#endif
@@ -0,0 +1,367 @@
+/**************************************************************
+ *
+ *                     libumtest.c
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Host program that checks what libum.h promises:
+ *              budgets, parking for input, supplying and ending
+ *              input, every fault, the memory limit and the cases
+ *              in which um_create refuses a program. Each check
+ *              builds a small UM program in memory, runs it through
+ *              the public interface only and compares what comes
+ *              back. "make check" builds and runs it; it prints
+ *              every failed check and exits with failure if there
+ *              was one.
+ *
+ **************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libum.h"
+
+/* Macro Definitions */
+#define MAX_TEST_WORDS 16
+#define MAX_TEST_OUTPUT 64
+
+/* UM opcodes, as the program file encodes them */
+enum { CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV, NAND, HALT, ACTIVATE,
+       INACTIVATE, OUT, IN, LOADP, LV };
+
+/*
+ * Name: testProgram
+ * Purpose: A UM program being built in memory, and the output it made
+ * Members: bytes - the program as a .um file would hold it
+ *          numWords - how many words are in it so far
+ *          output - what the machine gave the output function
+ *          outputLength - how many bytes of output there are
+ */
+typedef struct testProgram {
+        uint8_t bytes[MAX_TEST_WORDS * 4];
+        size_t numWords;
+        uint8_t output[MAX_TEST_OUTPUT];
+        size_t outputLength;
+} testProgram;
+
+static unsigned failures = 0;
+
+/* Function Declarations */
+static void emit(testProgram *test, uint32_t word);
+static uint32_t three(unsigned opcode, unsigned a, unsigned b, unsigned c);
+static uint32_t loadValue(unsigned a, uint32_t value);
+static void keepOutput(void *context, const uint8_t *bytes, size_t length);
+static um_vm *start(testProgram *test);
+static void check(bool condition, const char *name, const char *what);
+static void testHalt(void);
+static void testBudget(void);
+static void testInput(void);
+static void testFault(const char *name, const uint32_t *words,
+                      size_t numWords, um_fault fault, uint32_t pc);
+static void testFaults(void);
+static void testMemoryLimit(void);
+static void testCreate(void);
+
+int main(void)
+{
+        testHalt();
+        testBudget();
+        testInput();
+        testFaults();
+        testMemoryLimit();
+        testCreate();
+        if (failures != 0) {
+                fprintf(stderr, "libumtest: %u checks failed\n", failures);
+                return EXIT_FAILURE;
+        }
+        printf("libumtest: all checks passed\n");
+        return EXIT_SUCCESS;
+}
+
+/*
+ * Name: testHalt
+ * Purpose: Check that output reaches the host and a halt is final
+ * Parameters: None
+ * Returns: None
+ * Notes: None
+ */
+static void testHalt(void)
+{
+        testProgram test = { .numWords = 0 };
+        emit(&test, loadValue(1, 'H'));
+        emit(&test, three(OUT, 0, 0, 1));
+        emit(&test, loadValue(1, 'i'));
+        emit(&test, three(OUT, 0, 0, 1));
+        emit(&test, three(HALT, 0, 0, 0));
+
+        um_vm *vm = start(&test);
+        check(um_run(vm, 1000) == UM_HALTED, "halt", "status");
+        check(test.outputLength == 2 && memcmp(test.output, "Hi", 2) == 0,
+              "halt", "output");
+        check(um_instructions_run(vm) == 5, "halt", "instruction count");
+        check(um_run(vm, 1000) == UM_HALTED, "halt", "status after halt");
+        check(um_instructions_run(vm) == 5, "halt", "nothing runs after");
+        um_destroy(vm);
+}
+
+/*
+ * Name: testBudget
+ * Purpose: Check that a budget stops a program that never halts, exactly
+ * Parameters: None
+ * Returns: None
+ * Notes: The program jumps to itself forever
+ */
+static void testBudget(void)
+{
+        testProgram test = { .numWords = 0 };
+        emit(&test, loadValue(2, 1));
+        emit(&test, three(LOADP, 0, 0, 2));
+
+        um_vm *vm = start(&test);
+        check(um_run(vm, 100) == UM_BUDGET_EXHAUSTED, "budget", "status");
+        check(um_instructions_run(vm) == 100, "budget", "first count");
+        check(um_run(vm, 51) == UM_BUDGET_EXHAUSTED, "budget",
+              "status again");
+        check(um_instructions_run(vm) == 151, "budget", "second count");
+        check(um_program_counter(vm) == 1, "budget", "program counter");
+        check(um_run(vm, 0) == UM_BUDGET_EXHAUSTED, "budget", "zero budget");
+        check(um_instructions_run(vm) == 151, "budget", "zero runs none");
+        um_destroy(vm);
+}
+
+/*
+ * Name: testInput
+ * Purpose: Check parking for input, supplying it and ending it
+ * Parameters: None
+ * Returns: None
+ * Notes: The program echoes one byte, then prints '0' if the next input is
+ *        the end of input (all ones, which NAND turns into 0)
+ */
+static void testInput(void)
+{
+        testProgram test = { .numWords = 0 };
+        emit(&test, three(IN, 0, 0, 1));
+        emit(&test, three(OUT, 0, 0, 1));
+        emit(&test, three(IN, 0, 0, 1));
+        emit(&test, three(NAND, 3, 1, 1));
+        emit(&test, loadValue(4, '0'));
+        emit(&test, three(ADD, 5, 4, 3));
+        emit(&test, three(OUT, 0, 0, 5));
+        emit(&test, three(HALT, 0, 0, 0));
+
+        um_vm *vm = start(&test);
+        check(um_run(vm, 1000) == UM_NEEDS_INPUT, "input", "first park");
+        check(um_program_counter(vm) == 0, "input", "parked at the input");
+        check(um_instructions_run(vm) == 0, "input", "input not counted");
+        check(um_supply_input(vm, (const uint8_t *) "A", 1), "input",
+              "supply");
+        check(um_run(vm, 1000) == UM_NEEDS_INPUT, "input", "second park");
+        check(um_program_counter(vm) == 2, "input", "parked again");
+        um_end_input(vm);
+        check(um_run(vm, 1000) == UM_HALTED, "input", "status");
+        check(test.outputLength == 2 && memcmp(test.output, "A0", 2) == 0,
+              "input", "output");
+        um_destroy(vm);
+}
+
+/*
+ * Name: testFaults
+ * Purpose: Check that every kind of fault stops the program where it was
+ * Parameters: None
+ * Returns: None
+ * Notes: The memory limit has its own test
+ */
+static void testFaults(void)
+{
+        const uint32_t segment[] = {
+                loadValue(2, 5), three(SLOAD, 1, 2, 0)
+        };
+        testFault("segment", segment, 2, UM_FAULT_SEGMENT, 1);
+
+        const uint32_t offset[] = {
+                loadValue(2, 100), three(SSTORE, 0, 2, 1)
+        };
+        testFault("offset", offset, 2, UM_FAULT_SEGMENT, 1);
+
+        const uint32_t unmap[] = { three(INACTIVATE, 0, 0, 0) };
+        testFault("unmap", unmap, 1, UM_FAULT_UNMAP, 0);
+
+        const uint32_t end[] = { loadValue(1, 1) };
+        testFault("end", end, 1, UM_FAULT_PROGRAM_END, 1);
+
+        const uint32_t divide[] = { three(DIV, 1, 2, 3) };
+        testFault("divide", divide, 1, UM_FAULT_DIVIDE, 0);
+
+        const uint32_t output[] = {
+                loadValue(1, 300), three(OUT, 0, 0, 1)
+        };
+        testFault("output", output, 2, UM_FAULT_OUTPUT, 1);
+}
+
+/*
+ * Name: testFault
+ * Purpose: Check that one program faults the way it should
+ * Parameters: The name of the check, the program's words and how many there
+ *             are, the fault expected, the instruction expected to make it
+ * Returns: None
+ * Notes: The faulting instruction is not counted as run
+ */
+static void testFault(const char *name, const uint32_t *words,
+                      size_t numWords, um_fault fault, uint32_t pc)
+{
+        testProgram test = { .numWords = 0 };
+        for (size_t i = 0; i < numWords; i++) {
+                emit(&test, words[i]);
+        }
+
+        um_vm *vm = start(&test);
+        check(um_run(vm, 1000) == UM_FAULT, name, "status");
+        check(um_last_fault(vm) == fault, name, "fault");
+        check(um_program_counter(vm) == pc, name, "program counter");
+        check(um_instructions_run(vm) == pc, name, "instruction count");
+        check(um_run(vm, 1000) == UM_FAULT, name, "status after fault");
+        um_destroy(vm);
+}
+
+/*
+ * Name: testMemoryLimit
+ * Purpose: Check that a map past the memory limit faults and one under it
+ *          does not
+ * Parameters: None
+ * Returns: None
+ * Notes: None
+ */
+static void testMemoryLimit(void)
+{
+        testProgram test = { .numWords = 0 };
+        emit(&test, three(IN, 0, 0, 1));
+        emit(&test, three(MUL, 1, 1, 1));
+        emit(&test, three(ACTIVATE, 0, 2, 1));
+        emit(&test, three(HALT, 0, 0, 0));
+
+        /* 20 squared words fit in 1000 */
+        um_vm *vm = start(&test);
+        um_set_memory_limit(vm, 1000);
+        um_supply_input(vm, (const uint8_t *) "\x14", 1);
+        check(um_run(vm, 1000) == UM_HALTED, "limit", "map under it");
+        um_destroy(vm);
+
+        /* 40 squared do not */
+        vm = start(&test);
+        um_set_memory_limit(vm, 1000);
+        um_supply_input(vm, (const uint8_t *) "\x28", 1);
+        check(um_run(vm, 1000) == UM_FAULT, "limit", "status");
+        check(um_last_fault(vm) == UM_FAULT_MEMORY, "limit", "fault");
+        check(um_program_counter(vm) == 2, "limit", "program counter");
+        um_destroy(vm);
+}
+
+/*
+ * Name: testCreate
+ * Purpose: Check the programs um_create refuses
+ * Parameters: None
+ * Returns: None
+ * Notes: The length is checked before the bytes are read, so a short buffer
+ *        stands in for a program too big for the default memory limit
+ */
+static void testCreate(void)
+{
+        testProgram test = { .numWords = 0 };
+        emit(&test, three(HALT, 0, 0, 0));
+        check(um_create(test.bytes, 3, keepOutput, &test) == NULL, "create",
+              "partial word");
+        check(um_create(test.bytes, (UM_DEFAULT_MAX_WORDS + 1) * 4,
+                        keepOutput, &test) == NULL, "create",
+              "over the memory limit");
+
+        um_vm *vm = um_create(test.bytes, 0, NULL, NULL);
+        check(vm != NULL, "create", "empty program");
+        if (vm != NULL) {
+                check(um_run(vm, 10) == UM_FAULT &&
+                      um_last_fault(vm) == UM_FAULT_PROGRAM_END, "create",
+                      "empty program runs off the end");
+                um_destroy(vm);
+        }
+        um_destroy(NULL);
+}
+
+/*
+ * Name: start
+ * Purpose: Make a machine for a test program
+ * Parameters: The test program
+ * Returns: The machine
+ * Notes: Exits if um_create refuses the program, since no check can go on
+ */
+static um_vm *start(testProgram *test)
+{
+        test->outputLength = 0;
+        um_vm *vm = um_create(test->bytes, test->numWords * 4, keepOutput,
+                              test);
+        if (vm == NULL) {
+                fprintf(stderr, "libumtest: um_create failed\n");
+                exit(EXIT_FAILURE);
+        }
+        return vm;
+}
+
+/*
+ * Name: check
+ * Purpose: Count and report a check that failed
+ * Parameters: Whether the check passed, the test's name, what was checked
+ * Returns: None
+ * Notes: None
+ */
+static void check(bool condition, const char *name, const char *what)
+{
+        if (!condition) {
+                fprintf(stderr, "libumtest: %s: %s is wrong\n", name, what);
+                failures++;
+        }
+}
+
+/*
+ * Name: keepOutput
+ * Purpose: The output function, which appends to the test program's output
+ * Parameters: The test program, the bytes, how many there are
+ * Returns: None
+ * Notes: Output past MAX_TEST_OUTPUT is dropped
+ */
+static void keepOutput(void *context, const uint8_t *bytes, size_t length)
+{
+        testProgram *test = context;
+        for (size_t i = 0; i < length &&
+             test->outputLength < MAX_TEST_OUTPUT; i++) {
+                (test->output)[(test->outputLength)++] = bytes[i];
+        }
+}
+
+/*
+ * Name: emit
+ * Purpose: Add a word to a test program, big-endian as in a .um file
+ * Parameters: The test program, the word
+ * Returns: None
+ * Notes: None
+ */
+static void emit(testProgram *test, uint32_t word)
+{
+        uint8_t *at = &(test->bytes)[test->numWords * 4];
+        at[0] = word >> 24;
+        at[1] = word >> 16;
+        at[2] = word >> 8;
+        at[3] = word;
+        (test->numWords)++;
+}
+
+static uint32_t three(unsigned opcode, unsigned a, unsigned b, unsigned c)
+{
+        return ((uint32_t) opcode << 28) | (a << 6) | (b << 3) | c;
+}
+
+static uint32_t loadValue(unsigned a, uint32_t value)
+{
+        return ((uint32_t) LV << 28) | (a << 25) | value;
+}
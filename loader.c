@@ -0,0 +1,204 @@
+/**************************************************************
+ *
+ *                     loader.c
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Implementation of reading UM program files. The
+ *              file is mapped into memory rather than read a byte
+ *              at a time, and its big-endian words are turned into
+ *              host words sixteen or thirty-two bytes at a time with
+ *              SSSE3 or AVX2 shuffles when the CPU has them.
+ *
+ **************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "loader.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LOADER_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* Function Declarations */
+static void copyWordsScalar(uint32_t *dest, const uint8_t *src,
+                            size_t numWords);
+#ifdef LOADER_SIMD
+static void copyWordsSsse3(uint32_t *dest, const uint8_t *src,
+                           size_t numWords);
+static void copyWordsAvx2(uint32_t *dest, const uint8_t *src,
+                          size_t numWords);
+#endif
+
+/*
+ * Name: mapProgramFile
+ * Purpose: Map a UM program file into memory
+ * Parameters: The name of the file, places to store its bytes and its number
+ *             of words
+ * Returns: True if the file was mapped
+ * Notes: A file whose size is not a multiple of 4 is truncated and is
+ *        rejected, as is one with more words than a segment can hold.
+ *        Prints the reason for any failure to stderr. An empty file maps
+ *        to NULL and 0 words. Unmapped by unmapProgramFile
+ */
+bool mapProgramFile(const char *filename, const uint8_t **programBytes,
+                    uint32_t *numWords)
+{
+        *programBytes = NULL;
+        *numWords = 0;
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+                fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+                return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+                fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+                close(fd);
+                return false;
+        }
+        if (st.st_size % 4 != 0) {
+                fprintf(stderr, "%s: truncated program (%lld bytes is not a "
+                        "whole number of words)\n", filename,
+                        (long long) st.st_size);
+                close(fd);
+                return false;
+        }
+        if ((uint64_t) st.st_size / 4 > UINT32_MAX) {
+                fprintf(stderr, "%s: program too large (%lld words is more "
+                        "than a segment can hold)\n", filename,
+                        (long long) (st.st_size / 4));
+                close(fd);
+                return false;
+        }
+        if (st.st_size == 0) {
+                close(fd);
+                return true;
+        }
+
+        void *bytes = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (bytes == MAP_FAILED) {
+                fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+                return false;
+        }
+        madvise(bytes, st.st_size, MADV_SEQUENTIAL);
+
+        *programBytes = bytes;
+        *numWords = st.st_size / 4;
+        return true;
+}
+
+/*
+ * Name: unmapProgramFile
+ * Purpose: Release a file mapped by mapProgramFile
+ * Parameters: The bytes of the file, its number of words
+ * Returns: None
+ * Notes: Does nothing for an empty file
+ */
+void unmapProgramFile(const uint8_t *programBytes, uint32_t numWords)
+{
+        if (programBytes != NULL) {
+                munmap((void *) programBytes, (size_t) numWords * 4);
+        }
+}
+
+/*
+ * Name: copyBigEndianWords
+ * Purpose: Turn big-endian bytes into host words
+ * Parameters: Where to put the words, the bytes, the number of words
+ * Returns: None
+ * Notes: Uses the widest shuffle the CPU supports
+ */
+void copyBigEndianWords(uint32_t *dest, const uint8_t *src, size_t numWords)
+{
+#ifdef LOADER_SIMD
+        if (__builtin_cpu_supports("avx2")) {
+                copyWordsAvx2(dest, src, numWords);
+                return;
+        }
+        if (__builtin_cpu_supports("ssse3")) {
+                copyWordsSsse3(dest, src, numWords);
+                return;
+        }
+#endif
+        copyWordsScalar(dest, src, numWords);
+}
+
+/*
+ * Name: copyWordsScalar
+ * Purpose: Turn big-endian bytes into host words one word at a time
+ * Parameters: Where to put the words, the bytes, the number of words
+ * Returns: None
+ * Notes: Also finishes whatever the SIMD versions leave over
+ */
+static void copyWordsScalar(uint32_t *dest, const uint8_t *src,
+                            size_t numWords)
+{
+        for (size_t i = 0; i < numWords; i++) {
+                dest[i] = (uint32_t) src[4 * i] << 24 |
+                          (uint32_t) src[4 * i + 1] << 16 |
+                          (uint32_t) src[4 * i + 2] << 8 |
+                          (uint32_t) src[4 * i + 3];
+        }
+}
+
+#ifdef LOADER_SIMD
+
+/*
+ * Name: copyWordsSsse3
+ * Purpose: Turn big-endian bytes into host words four words at a time
+ * Parameters: Where to put the words, the bytes, the number of words
+ * Returns: None
+ * Notes: Only called when the CPU has SSSE3
+ */
+__attribute__((target("ssse3")))
+static void copyWordsSsse3(uint32_t *dest, const uint8_t *src,
+                           size_t numWords)
+{
+        const __m128i reverse = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+                                              11, 10, 9, 8, 15, 14, 13, 12);
+        size_t i = 0;
+        for (; i + 4 <= numWords; i += 4) {
+                __m128i words = _mm_loadu_si128((const __m128i *)
+                                                (src + 4 * i));
+                _mm_storeu_si128((__m128i *) (dest + i),
+                                 _mm_shuffle_epi8(words, reverse));
+        }
+        copyWordsScalar(dest + i, src + 4 * i, numWords - i);
+}
+
+/*
+ * Name: copyWordsAvx2
+ * Purpose: Turn big-endian bytes into host words eight words at a time
+ * Parameters: Where to put the words, the bytes, the number of words
+ * Returns: None
+ * Notes: Only called when the CPU has AVX2
+ */
+__attribute__((target("avx2")))
+static void copyWordsAvx2(uint32_t *dest, const uint8_t *src,
+                          size_t numWords)
+{
+        const __m256i reverse = _mm256_setr_epi8(
+                3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+        size_t i = 0;
+        for (; i + 8 <= numWords; i += 8) {
+                __m256i words = _mm256_loadu_si256((const __m256i *)
+                                                   (src + 4 * i));
+                _mm256_storeu_si256((__m256i *) (dest + i),
+                                    _mm256_shuffle_epi8(words, reverse));
+        }
+        copyWordsScalar(dest + i, src + 4 * i, numWords - i);
+}
+
+#endif
@@ -0,0 +1,25 @@
+/**************************************************************
+ *
+ *                     loader.h
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Interface for reading UM program files
+ *
+ **************************************************************/
+
+#ifndef LOADER_INCLUDED
+#define LOADER_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+bool mapProgramFile(const char *filename, const uint8_t **programBytes,
+                    uint32_t *numWords);
+void unmapProgramFile(const uint8_t *programBytes, uint32_t numWords);
+void copyBigEndianWords(uint32_t *dest, const uint8_t *src, size_t numWords);
+
+#endif
@@ -0,0 +1,261 @@
+/**************************************************************
+ *
+ *                     memcore.h
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Inside view of the UM memory for the interpreter's
+ *              hot path. Completes struct memoryInfo and gives
+ *              inline segment loads and stores, so the command loop
+ *              can keep the registers, program counter and unpacked
+ *              program in locals and never call across files for
+ *              the common instructions.
+ *
+ *              Only memory.c, dispatch.c and jit.c (whose code
+ *              reads the segment table directly) include this file.
+ *              Everything else goes through memory.h.
+ *
+ **************************************************************/
+
+#ifndef MEMCORE_INCLUDED
+#define MEMCORE_INCLUDED
+
+#include "memory.h"
+#include "segpool.h"
+#include "optimize.h"
+
+#define NUM_REGS 8
+#define NUM_SIZE_CLASSES 33
+#define SEGMENT_OVERHEAD_WORDS 4
+#define TABLE_ENTRY_WORDS 3
+
+/*
+ * Name: segmentInfo
+ * Purpose: struct for memory segment
+ * Members: length - The number of words in the segment
+ *          refCount - How many places (segment 0 and/or a mapped ID) use
+ *                     this segment. A shared segment is copied before it
+ *                     is written
+ *          segData - An array of the words in the segment
+ */
+typedef struct segmentInfo {
+        uint32_t length;
+        uint32_t refCount;
+        Um_instruction segData[];
+} *segmentInfo;
+
+/*
+ * Name: segmentStats
+ * Purpose: Running totals of the memory held by segments
+ * Members: liveSegments - segments allocated and not freed yet. A segment
+ *                         that segment 0 shares with a mapped ID counts once
+ *          peakSegments - the most segments ever live at once
+ *          allocatedSegments - every segment ever allocated, including the
+ *                              copies made when a shared segment is stored to
+ *          liveWords, peakWords - the same for the words in the segments
+ *          peakFreeIDs - the deepest the free ID stack has been
+ *          tableGrowths - how many times the segment table was doubled
+ *          programLoads - loadProgram calls from a non-zero segment
+ *          memoizedLoads - those that found segment 0 already sharing the
+ *                          segment and reused its unpacked form
+ *          allocatedBySize, liveBySize - allocatedSegments and liveSegments
+ *                                        by size. Class 0 is empty segments
+ *                                        and class n holds lengths from
+ *                                        2^(n-1) to 2^n - 1
+ */
+typedef struct segmentStats {
+        uint64_t liveSegments;
+        uint64_t peakSegments;
+        uint64_t allocatedSegments;
+        uint64_t liveWords;
+        uint64_t peakWords;
+        uint64_t peakFreeIDs;
+        uint64_t tableGrowths;
+        uint64_t programLoads;
+        uint64_t memoizedLoads;
+        uint64_t allocatedBySize[NUM_SIZE_CLASSES];
+        uint64_t liveBySize[NUM_SIZE_CLASSES];
+} segmentStats;
+
+/*
+ * Name: memoryInfo
+ * Purpose: Contain all information having to do with UM memory
+ * Members: segments - table of all segments indexed by segment ID, so
+ *                     segments[0] is the program. Unmapped IDs are NULL
+ *          tableSize - the number of entries allocated for segments
+ *          freeIDs - stack of unmapped IDs that can be reused
+ *          numFreeIDs - the number of IDs on the stack. The stack has
+ *                       tableSize entries, enough to hold every ID
+ *          pool - the allocator every segment comes from
+ *          decoded - segment 0 with every instruction already unpacked. Kept
+ *                    in step with segment 0 by loadProgram and segStore
+ *          optimized - segment 0 as the load-time optimizer left it, or NULL
+ *                      unless optimize is set (see optimize.c)
+ *          blockFlags - for each word of segment 0, whether the optimized
+ *                       form may be entered there and whether it was changed
+ *          optimize - true if every program loaded is optimized
+ *          jumpsToOptimize - jumps within segment 0 the program loadProgram
+ *                            loaded last may make before it is optimized,
+ *                            or 0 if it is not waiting to be
+ *          programCounter - keeps track of which instruction program is on
+ *          programVersion - bumped every time the contents of segment 0
+ *                           change, so cached translations can be dropped
+ *          maxSegementID - one more than the highest ID ever used
+ *          allRegs - the emulated registers
+ *          checkpointPath - where to save a checkpoint the first time input
+ *                           would block, or NULL
+ *          image - the checkpoint image this memory was restored from, or
+ *                  NULL. Segments inside it are never given to the pool
+ *          imageSize - the number of bytes mapped at image
+ *          stats - what the segments hold, see writeMemoryStats
+ * Notes: While runProgram is running, the registers and program counter
+ *        here are only up to date around calls into memory.c
+ */
+struct memoryInfo {
+        segmentInfo *segments;
+        uint32_t tableSize;
+        uint32_t *freeIDs;
+        uint32_t numFreeIDs;
+        segPool pool;
+        Um_decoded *decoded;
+        Um_decoded *optimized;
+        uint8_t *blockFlags;
+        bool optimize;
+        uint32_t jumpsToOptimize;
+        uint32_t programCounter;
+        uint32_t programVersion;
+        uint32_t maxSegmentID;
+        uint32_t allRegs[NUM_REGS];
+        const char *checkpointPath;
+        uint8_t *image;
+        size_t imageSize;
+        segmentStats stats;
+};
+
+void storeWordSlow(memoryInfo memory, uint32_t id, uint32_t offset,
+                   uint32_t value);
+void optimizeLoadedProgram(memoryInfo memory);
+
+/*
+ * Name: loadWord
+ * Purpose: Read a word of a segment
+ * Parameters: The struct containing the memory structures and variables, the
+ *             segment ID, the offset of the word
+ * Returns: The word
+ * Notes: Segment 0 lives in the segment table like any other segment, so
+ *        there is no special case
+ */
+static inline uint32_t loadWord(memoryInfo memory, uint32_t id,
+                                uint32_t offset)
+{
+        return ((memory->segments)[id]->segData)[offset];
+}
+
+/*
+ * Name: storeWord
+ * Purpose: Write a word of a segment
+ * Parameters: The struct containing the memory structures and variables, the
+ *             segment ID, the offset of the word, the value to write
+ * Returns: None
+ * Notes: Stores into segment 0 or into a shared segment need more work and
+ *        are left to storeWordSlow
+ */
+static inline void storeWord(memoryInfo memory, uint32_t id, uint32_t offset,
+                             uint32_t value)
+{
+        segmentInfo segment = (memory->segments)[id];
+        if (id == 0 || segment->refCount > 1) {
+                storeWordSlow(memory, id, offset, value);
+                return;
+        }
+        (segment->segData)[offset] = value;
+}
+
+/*
+ * Name: isMapped
+ * Purpose: Say whether a segment ID is in use
+ * Parameters: The struct containing the memory structures and variables, the
+ *             segment ID
+ * Returns: True if the ID names a segment
+ * Notes: For loops that must check every access themselves
+ */
+static inline bool isMapped(memoryInfo memory, uint32_t id)
+{
+        return id < memory->maxSegmentID && (memory->segments)[id] != NULL;
+}
+
+/*
+ * Name: inSegment
+ * Purpose: Say whether a word can be loaded or stored
+ * Parameters: The struct containing the memory structures and variables, the
+ *             segment ID, the offset of the word
+ * Returns: True if the ID names a segment that has a word at the offset
+ * Notes: See isMapped
+ */
+static inline bool inSegment(memoryInfo memory, uint32_t id, uint32_t offset)
+{
+        return isMapped(memory, id) &&
+               offset < (memory->segments)[id]->length;
+}
+
+/*
+ * Name: wordsAfterMap
+ * Purpose: Say how much memory segments would hold after mapping one more
+ * Parameters: The struct containing the memory structures and variables, the
+ *             number of words in the new segment
+ * Returns: The total in words, counting every live segment's words, its
+ *          header and block rounding (SEGMENT_OVERHEAD_WORDS), and the
+ *          segment table and free ID stack (TABLE_ENTRY_WORDS an entry) at
+ *          the size the map would leave them
+ * Notes: For a memory limit that even empty segments count against
+ */
+static inline uint64_t wordsAfterMap(memoryInfo memory, uint32_t length)
+{
+        uint64_t tableSize = memory->tableSize;
+        if (memory->numFreeIDs == 0 && memory->maxSegmentID == tableSize) {
+                tableSize *= 2;
+        }
+        return memory->stats.liveWords + length +
+               (memory->stats.liveSegments + 1) * SEGMENT_OVERHEAD_WORDS +
+               tableSize * TABLE_ENTRY_WORDS;
+}
+
+/*
+ * Name: countJump
+ * Purpose: Note a jump within segment 0, for the lazy optimizer
+ * Parameters: The struct containing the memory structures and variables
+ * Returns: None
+ * Notes: Must come before programAt picks the form to run after the jump,
+ *        since it may build the optimized form
+ */
+static inline void countJump(memoryInfo memory)
+{
+        if (memory->jumpsToOptimize != 0 &&
+            --(memory->jumpsToOptimize) == 0) {
+                optimizeLoadedProgram(memory);
+        }
+}
+
+/*
+ * Name: programAt
+ * Purpose: Choose the unpacked form of segment 0 to run from after a jump
+ * Parameters: The struct containing the memory structures and variables, the
+ *             index jumped to
+ * Returns: The optimized form if a block starts at the index, and the plain
+ *          unpacked form otherwise
+ * Notes: Only valid until the next loadProgram. A jump past the end of the
+ *        program gets the plain form, whose fetch deals with it
+ */
+static inline const Um_decoded *programAt(memoryInfo memory, uint32_t pc)
+{
+        if (memory->blockFlags != NULL &&
+            pc < (memory->segments)[0]->length &&
+            ((memory->blockFlags)[pc] & BLOCK_START)) {
+                return memory->optimized;
+        }
+        return memory->decoded;
+}
+
+#endif
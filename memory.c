@@ -9,112 +9,186 @@
  *     Purpose: Implementation for manipulation of
  *              the UM memory.
  *
+ *              The whole machine can be saved to a checkpoint image
+ *              and resumed from one. A restored machine maps the image
+ *              privately and its segments stay inside it, so only the
+ *              pages the program touches are ever read.
+ *
  **************************************************************/
 
-#include "memory.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "except.h"
+#include "memcore.h"
+#include "loader.h"
+#include "optimize.h"
+#include "profile.h"
 
 #define A regsInCommand[0]
 #define B regsInCommand[1]
 #define C regsInCommand[2]
-#define NUM_REGS 8
-#define MEMORY_INFO_SIZE 64
-#define INIT_SEQ_SIZE 100
-
-/*
- * Name: segmentInfo
- * Purpose: struct for memory segment
- * Members: length - The number of words in the segment
- *          segData - An array of the words in the segment
- */
-typedef struct segmentInfo {
-        uint32_t length;
-        Um_instruction segData[];
-} *segmentInfo;
-
-/*
- * Name: memoryInfo
- * Purpose: Contain all information having to do with UM memory
- * Members: mainMemory - sequence containing all segments (besides segment 0)
- *          recentlyUnmapped - sequence containing all unmapped IDs
- *          program - struct representing segment 0. This is separate from
- *                    mainMemory to make it more likely that it will be placed
- *                    in a register
- *          programCounter - keeps track of which instruction program is on
- *          maxSegementID - the number of the highest ID ever used
+#define INIT_TABLE_SIZE 100
+#define OPCODE_LSB 28
+#define LV_REG_LSB 25
+#define LV_VALUE_MASK 0x1ffffff
+#define REG_MASK 0x7
+#define MAX_FUSED_LENGTH 3
+#define CHECKPOINT_MAGIC "UMCKPT1"
+#define CHECKPOINT_ALIGN 8
+#define STATS_BUFFER_SIZE 8192
+#define OPTIMIZE_AFTER_JUMPS 1024
+
+/* Set by requestMemoryStats, from a signal handler */
+static volatile sig_atomic_t statsRequested = 0;
+
+/*
+ * Name: statsBuffer
+ * Purpose: Text being put together by writeMemoryStats
+ * Members: text - the characters so far
+ *          length - how many there are. Text that does not fit is dropped
+ */
+typedef struct statsBuffer {
+        char text[STATS_BUFFER_SIZE];
+        size_t length;
+} statsBuffer;
+
+/*
+ * Name: checkpointHeader
+ * Purpose: The start of a checkpoint image
+ * Members: magic - CHECKPOINT_MAGIC, to catch files that are not images
+ *          programCounter - the instruction to resume at
+ *          maxSegmentID - one more than the highest ID ever used
+ *          numFreeIDs - the number of IDs on the free ID stack
+ *          outputLength - the number of bytes of output before the
+ *                         checkpoint
  *          allRegs - the emulated registers
+ * Notes: The header is followed by the output, the free ID stack, a table
+ *        with the image offset of every segment ID (0 when unmapped), then
+ *        the segments laid out exactly like segmentInfo. Each part starts on
+ *        a multiple of CHECKPOINT_ALIGN. Words are in host byte order
  */
-struct memoryInfo {
-        Seq_T mainMemory;
-        Seq_T recentlyUnmapped;
-        segmentInfo program;
+typedef struct checkpointHeader {
+        char magic[8];
         uint32_t programCounter;
         uint32_t maxSegmentID;
+        uint32_t numFreeIDs;
+        uint32_t unused;
+        uint64_t outputLength;
         uint32_t allRegs[NUM_REGS];
-};
+} checkpointHeader;
+
+static Um_decoded decodeInstruction(Um_instruction instruction);
+static void decodeProgram(memoryInfo memory);
+static void buildOptimized(memoryInfo memory);
+static void freeOptimized(memoryInfo memory);
+static unsigned fusedOpcode(segmentInfo program, uint32_t index);
+static inline unsigned opcodeAt(segmentInfo program, uint64_t index);
+static inline size_t segmentBytes(uint32_t length);
+static segmentInfo newSegment(memoryInfo memory, uint32_t length);
+static segmentInfo unshareSegment(memoryInfo memory, segmentInfo segment);
+static void releaseSegment(memoryInfo memory, segmentInfo segment);
+static void growTable(memoryInfo memory);
+static inline size_t alignCheckpoint(size_t size);
+static bool writePadded(FILE *file, const void *data, size_t size);
+static inline bool inImage(memoryInfo memory, segmentInfo segment);
+static inline unsigned sizeClassOf(uint32_t length);
+static void countAllocation(memoryInfo memory, uint32_t length);
+static void countRelease(memoryInfo memory, uint32_t length);
+static void appendText(statsBuffer *buffer, const char *text);
+static void appendNumber(statsBuffer *buffer, uint64_t number);
+static void appendCounts(statsBuffer *buffer, const char *name,
+                         uint64_t first, const char *firstName,
+                         uint64_t second, const char *secondName);
 
 /*
  * Name: makeMemoryInfo
  * Purpose: Initialize the memory structures and variables for the UM
- * Parameters: The number of instructions for segment 0, the input command file
+ * Parameters: The program file's bytes, the number of instructions in it
  * Returns: A struct containing the memory structures and variables
- * Notes: memory is freed after halt by freeMemory
+ * Notes: memory is freed after halt by freeMemory. The bytes are copied, so
+ *        the caller may release them once this returns. If an allocation
+ *        fails, whatever was made is freed before failAllocation is called
+ *        again for the caller
  */
-memoryInfo makeMemoryInfo(uint32_t numInstructions, FILE *commandFile)
+memoryInfo makeMemoryInfo(const uint8_t *programBytes,
+                          uint32_t numInstructions)
 {
         /* Allocate space for memoryInfo. All bits in memory are set to 0 */
-        memoryInfo memory = CALLOC(MEMORY_INFO_SIZE, 1);
-        memory->recentlyUnmapped = Seq_new(INIT_SEQ_SIZE);
-        memory->mainMemory = Seq_new(INIT_SEQ_SIZE);
+        memoryInfo memory = allocOrFail(1, sizeof(struct memoryInfo));
+        jmp_buf landing;
+        jmp_buf *outer = catchAllocFailures(&landing);
+        if (setjmp(landing) != 0) {
+                catchAllocFailures(outer);
+                freeMemory(memory);
+                failAllocation();
+        }
+        memory->segments = allocOrFail(INIT_TABLE_SIZE, sizeof(segmentInfo));
+        memory->tableSize = INIT_TABLE_SIZE;
+        memory->freeIDs = allocOrFail(INIT_TABLE_SIZE, sizeof(uint32_t));
+        memory->pool = makeSegPool();
         memory->maxSegmentID = 1;
 
         /* Create and fill segment 0 with instructions */
-        loadInitialProgram(memory, numInstructions, commandFile);
-        
+        loadInitialProgram(memory, programBytes, numInstructions);
+        catchAllocFailures(outer);
         return memory;
 }
 
+/*
+ * Name: startRecycler
+ * Purpose: Have a background thread zero segments after they are freed
+ * Parameters: The struct containing the memory structures and variables
+ * Returns: True if the thread is running
+ * Notes: Freed segments of 1 KB or more then reach mapSeg already zeroed.
+ *        The thread stops when the memory is freed
+ */
+bool startRecycler(memoryInfo memory)
+{
+        return poolStartRecycler(memory->pool);
+}
+
+/*
+ * Name: enableOptimizer
+ * Purpose: Run segment 0 through the load-time optimizer from now on
+ * Parameters: The struct containing the memory structures and variables
+ * Returns: None
+ * Notes: Optimizes the program loaded now at once. Ones loadProgram loads
+ *        later wait until they have made OPTIMIZE_AFTER_JUMPS jumps within
+ *        segment 0 (see optimizeLoadedProgram). Must not be called while
+ *        runProgram is running
+ */
+void enableOptimizer(memoryInfo memory)
+{
+        memory->optimize = true;
+        buildOptimized(memory);
+}
+
 /*
  * Name: loadInitialProgram
- * Purpose: Read in instructions from command file
+ * Purpose: Fill segment 0 with the instructions from a program file
  * Parameters: The struct containing the memory structures and variables, the
- *             number of instructions in command file, a pointer to command file
+ *             program file's bytes, the number of instructions in it
  * Returns: None
  * Notes: Segment 0 (program) will be filled with instructions. The memory
  *        allocated for program is freed either when loadProgam is called or
  *        after halt
  */
-void loadInitialProgram(memoryInfo memory, int numInstructions,
-                                                        FILE *commandFile)
+void loadInitialProgram(memoryInfo memory, const uint8_t *programBytes,
+                        uint32_t numInstructions)
 {
-        /*
-         * Allocate memory for number of instructions plus the int to hold the
-         * number of instructions
-         */
-        segmentInfo program = CALLOC(numInstructions + 1, sizeof(uint32_t));
-        
-        /*
-         * Keep track of the current byte and the current instruction being
-         * built 
-         */
-        Um_instruction currInstruction;
-        uint32_t currByte;
-        
-        /*
-         * Build each instruction by reading a byte at a time from the command
-         * file and adding it to a 32 bit instruction. Then add that instruction
-         * to the segment 0's array
-         */
-        for (int i = 0; i < numInstructions; i++) {
-                currInstruction = 0;
-                for (int j = 3; j >= 0; j--) {
-                        currByte = fgetc(commandFile);
-                        currByte = currByte << 8 * j;
-                        currInstruction |= currByte;
-                }
-                (program->segData)[i] = currInstruction;
-        }
+        /* Allocate memory for the instructions and the segment's header */
+        segmentInfo program = newSegment(memory, numInstructions);
+
+        /* Each instruction is stored in the file as a big-endian word */
+        copyBigEndianWords(program->segData, programBytes, numInstructions);
 
-        memory->program = program;
+        (memory->segments)[0] = program;
+        decodeProgram(memory);
 }
 
 /*
@@ -126,7 +200,20 @@ void loadInitialProgram(memoryInfo memory, int numInstructions,
  */
 Um_instruction getCurrInstruction(memoryInfo memory)
 {
-        return (memory->program->segData)[memory->programCounter];
+        return ((memory->segments)[0]->segData)[memory->programCounter];
+}
+
+/*
+ * Name: getCurrDecoded
+ * Purpose: Get the unpacked instruction at the index specified by the program
+ *          counter
+ * Parameters: The struct containing the memory structures and variables
+ * Returns: A pointer to the unpacked instruction
+ * Notes: The pointer is only valid until the next loadProgram
+ */
+const Um_decoded *getCurrDecoded(memoryInfo memory)
+{
+        return &(memory->decoded)[memory->programCounter];
 }
 
 /*
@@ -162,19 +249,12 @@ void setRegisterValue(memoryInfo memory, uint32_t regNum, uint32_t value)
  * Parameters: The registers in the instruction, the struct containing the
  *             memory structures and variables
  * Returns: None
- * Notes: Segment 0 is not in mainMemory so it has a special case
+ * Notes: See loadWord
  */
 void segLoad(uint32_t regsInCommand[], memoryInfo memory)
 {
-        if ((memory->allRegs)[B] == 0) {
-                (memory->allRegs)[A] =
-                        (memory->program->segData)[(memory->allRegs)[C]];
-        }
-        else {
-                segmentInfo segment = Seq_get(memory->mainMemory,
-                                                (memory->allRegs)[B] - 1);
-                (memory->allRegs)[A] = (segment->segData)[(memory->allRegs)[C]];
-        }
+        (memory->allRegs)[A] = loadWord(memory, (memory->allRegs)[B],
+                                        (memory->allRegs)[C]);
 }
 
 /*
@@ -184,18 +264,50 @@ void segLoad(uint32_t regsInCommand[], memoryInfo memory)
  * Parameters: The registers in the instruction, the struct containing the
  *             memory structures and variables
  * Returns: None
- * Notes: Segment 0 is not in mainMemory so it has a special case
+ * Notes: See storeWord
  */
 void segStore(uint32_t regsInCommand[], memoryInfo memory)
 {
-        if ((memory->allRegs)[A] == 0){
-                (memory->program->segData)[(memory->allRegs)[B]] =
-                                                        (memory->allRegs)[C];
+        storeWord(memory, (memory->allRegs)[A], (memory->allRegs)[B],
+                  (memory->allRegs)[C]);
+}
+
+/*
+ * Name: storeWordSlow
+ * Purpose: Write a word of segment 0 or of a shared segment
+ * Parameters: The struct containing the memory structures and variables, the
+ *             segment ID, the offset of the word, the value to write
+ * Returns: None
+ * Notes: A store into segment 0 also replaces the unpacked form of that
+ *        instruction, and fuses again every sequence the word could be part
+ *        of. The unpacked program stays where it is.
+ *        A segment shared between segment 0 and a mapped ID is copied first
+ *        so the store is only seen through the ID it was made to
+ */
+void storeWordSlow(memoryInfo memory, uint32_t id, uint32_t offset,
+                   uint32_t value)
+{
+        segmentInfo segment = (memory->segments)[id];
+        if (segment->refCount > 1) {
+                segment = unshareSegment(memory, segment);
+                (memory->segments)[id] = segment;
         }
-        else {
-                segmentInfo segment = Seq_get(memory->mainMemory,
-                                                (memory->allRegs)[A] - 1);
-                (segment->segData)[(memory->allRegs)[B]] = (memory->allRegs)[C];
+        (segment->segData)[offset] = value;
+
+        if (id == 0) {
+                (memory->decoded)[offset] = decodeInstruction(value);
+                uint32_t first = offset >= MAX_FUSED_LENGTH - 1
+                                 ? offset - (MAX_FUSED_LENGTH - 1) : 0;
+                for (uint32_t i = first; i <= offset; i++) {
+                        (memory->decoded)[i].opcode =
+                                fusedOpcode(segment, i);
+                }
+                if (memory->optimized != NULL) {
+                        deoptimizeBlock(memory->decoded, segment->length,
+                                        memory->optimized,
+                                        memory->blockFlags, offset);
+                }
+                (memory->programVersion)++;
         }
 }
 
@@ -209,33 +321,33 @@ void segStore(uint32_t regsInCommand[], memoryInfo memory)
  */
 void mapSeg(uint32_t regsInCommand[], memoryInfo memory)
 {
-        /*
-         * Create new segment - each element is a uint32_t and the number of
-         * these is allRegs[C] + 1 to account for the "length" variable in the
-         * struct
-         */
-        segmentInfo newSeg = CALLOC((memory->allRegs)[C] + 1, sizeof(uint32_t));
-        newSeg->length = (memory->allRegs)[C];
-
         /*
          * Determine the segment ID. If there are any IDs that can be reused,
          * use one of them. Otherwise use the ID that is 1 higher than the
-         * highest one in use
+         * highest one in use, doubling the table first if it is full. The
+         * table grows before the segment is made so an allocation that fails
+         * never leaves an ID past the end of the table or a segment nothing
+         * points to
          */
         uint32_t newID;
-        if (Seq_length(memory->recentlyUnmapped) > 0) {
-                uint32_t *newIDp = Seq_remhi(memory->recentlyUnmapped);
-                newID = *newIDp;
-                FREE(newIDp);
-                Seq_put(memory->mainMemory, newID - 1, (void *) newSeg);
+        if (memory->numFreeIDs > 0) {
+                (memory->numFreeIDs)--;
+                newID = (memory->freeIDs)[memory->numFreeIDs];
         }
         else {
                 newID = memory->maxSegmentID;
-                Seq_addhi(memory->mainMemory, (void *) newSeg);
+                if (newID == memory->tableSize) {
+                        growTable(memory);
+                        (memory->stats.tableGrowths)++;
+                }
                 (memory->maxSegmentID)++;
         }
         assert(newID != 0);
 
+        /* Create new segment with every word set to 0 */
+        (memory->segments)[newID] = newSegment(memory, (memory->allRegs)[C]);
+        PROFILE_MAP_SEG((memory->allRegs)[C]);
+
         /* Save the new ID in a register */
         (memory->allRegs)[B] = newID;
 }
@@ -246,22 +358,23 @@ void mapSeg(uint32_t regsInCommand[], memoryInfo memory)
  * Parameters: The registers in the instruction, the struct containing the
  *             memory structures and variables
  * Returns: None
- * Notes: Adds the removed segment's ID to a sequence so it can be reused.
- *        Memory must be allocated for this number and it will be free either
- *        when a segment uses it as an ID or after halt
+ * Notes: Pushes the removed segment's ID on the free ID stack so it can be
+ *        reused. The stack can hold every ID, so it never has to grow here
  */
 void unmapSeg(uint32_t regsInCommand[],  memoryInfo memory)
 {
-        /* Free the segment memory */
-        segmentInfo unmap = Seq_get(memory->mainMemory,
-                                                (memory->allRegs)[C] - 1);
-        FREE(unmap);
-        Seq_put(memory->mainMemory, (memory->allRegs)[C] - 1, NULL);
+        PROFILE_UNMAP_SEG();
+
+        /* Free the segment memory unless segment 0 still shares it */
+        releaseSegment(memory, (memory->segments)[(memory->allRegs)[C]]);
+        (memory->segments)[(memory->allRegs)[C]] = NULL;
 
-        /* Add the ID to a sequence so it can be reused */
-        uint32_t *unmappedID = ALLOC(sizeof(uint32_t));
-        *unmappedID = (memory->allRegs)[C];
-        Seq_addhi(memory->recentlyUnmapped, (void *) unmappedID);
+        /* Add the ID to the stack so it can be reused */
+        (memory->freeIDs)[memory->numFreeIDs] = (memory->allRegs)[C];
+        (memory->numFreeIDs)++;
+        if (memory->numFreeIDs > memory->stats.peakFreeIDs) {
+                memory->stats.peakFreeIDs = memory->numFreeIDs;
+        }
 }
 
 /*
@@ -271,7 +384,9 @@ void unmapSeg(uint32_t regsInCommand[],  memoryInfo memory)
  * Parameters: The registers in the instruction, the struct containing the
  *             memory structures and variables
  * Returns: None
- * Notes: None
+ * Notes: Segment 0 shares the source segment's words instead of copying
+ *        them. Whichever side is stored to first gets its own copy, so
+ *        loading a segment segment 0 still shares reuses everything
  */
 void loadProgram(uint32_t regsInCommand[],  memoryInfo memory)
 {
@@ -281,25 +396,35 @@ void loadProgram(uint32_t regsInCommand[],  memoryInfo memory)
          */
         uint32_t newCounter = (memory->allRegs)[C];
         if ((memory->allRegs)[B] == 0) {
+                PROFILE_LOAD_PROGRAM(true, 0);
                 memory->programCounter = newCounter;
                 return;
         }
 
-        FREE(memory->program);
+        /*
+         * Share the desired segment with segment 0. It is retained before the
+         * old program is released in case they are the same segment
+         */
+        segmentInfo incomingProgram = (memory->segments)[(memory->allRegs)[B]];
+        (memory->stats.programLoads)++;
 
         /*
-         * Allocate memory for the new program and perform a deep copy from the
-         * desired segment into segment 0
+         * If segment 0 still shares the segment from an earlier load, neither
+         * side has been stored to since, so the unpacked program is still
+         * right and there is nothing to do but jump
          */
-        segmentInfo incomingProgram = Seq_get(memory->mainMemory,
-                                                (memory->allRegs)[B] - 1);
-        int newProgramLength = incomingProgram->length;
-        segmentInfo newProgram = CALLOC(newProgramLength + 1, 4);
-        newProgram->length = newProgramLength;
-        for (int i = 0; i < newProgramLength; i++) {
-                (newProgram->segData)[i] = (incomingProgram->segData)[i];
+        if (incomingProgram == (memory->segments)[0]) {
+                (memory->stats.memoizedLoads)++;
+                PROFILE_LOAD_PROGRAM(false, 0);
+                memory->programCounter = newCounter;
+                return;
         }
-        memory->program = newProgram;
+        (incomingProgram->refCount)++;
+        releaseSegment(memory, (memory->segments)[0]);
+        (memory->segments)[0] = incomingProgram;
+        decodeProgram(memory);
+        (memory->programVersion)++;
+        PROFILE_LOAD_PROGRAM(false, incomingProgram->length);
 
         /* Set the program counter */
         memory->programCounter = newCounter;
@@ -317,38 +442,919 @@ void incrementProgramCounter(memoryInfo memory)
         (memory->programCounter)++;
 }
 
+/*
+ * Name: getProgramCounter
+ * Purpose: Get the program counter
+ * Parameters: The struct containing the memory structures and variables
+ * Returns: The index of the next instruction to run
+ * Notes: None
+ */
+uint32_t getProgramCounter(memoryInfo memory)
+{
+        return memory->programCounter;
+}
+
+/*
+ * Name: setProgramCounter
+ * Purpose: Set the program counter
+ * Parameters: The struct containing the memory structures and variables, the
+ *             index of the next instruction to run
+ * Returns: None
+ * Notes: None
+ */
+void setProgramCounter(memoryInfo memory, uint32_t programCounter)
+{
+        memory->programCounter = programCounter;
+}
+
+/*
+ * Name: getRegisterFile
+ * Purpose: Get direct access to the eight registers
+ * Parameters: The struct containing the memory structures and variables
+ * Returns: A pointer to the first of the eight registers
+ * Notes: Used by the JIT, which keeps the registers in host registers and
+ *        writes them back here before calling into this module
+ */
+uint32_t *getRegisterFile(memoryInfo memory)
+{
+        return memory->allRegs;
+}
+
+/*
+ * Name: getDecodedProgram
+ * Purpose: Get the unpacked form of all of segment 0
+ * Parameters: The struct containing the memory structures and variables, a
+ *             pointer to store the number of instructions in
+ * Returns: A pointer to the first unpacked instruction
+ * Notes: The pointer is only valid until the program version changes
+ */
+const Um_decoded *getDecodedProgram(memoryInfo memory, uint32_t *length)
+{
+        *length = (memory->segments)[0]->length;
+        return memory->decoded;
+}
+
+/*
+ * Name: getProgramVersion
+ * Purpose: Get a number that changes whenever segment 0 changes
+ * Parameters: The struct containing the memory structures and variables
+ * Returns: The program version
+ * Notes: Changed by loadProgram from a non-zero segment and by any store
+ *        into segment 0
+ */
+uint32_t getProgramVersion(memoryInfo memory)
+{
+        return memory->programVersion;
+}
+
+/*
+ * Name: baseOpcode
+ * Purpose: Get the opcode of the first instruction of an unpacked opcode
+ * Parameters: An opcode from the unpacked form of segment 0
+ * Returns: The UM opcode it stands for, which for a superinstruction is the
+ *          opcode of its first instruction
+ * Notes: For code that handles instructions one at a time, like the JIT
+ */
+Um_opcode baseOpcode(unsigned opcode)
+{
+        switch (opcode) {
+        case FUSED_LV_SLOAD:
+        case FUSED_LV_SSTORE:
+        case FUSED_LV_LV:
+        case FUSED_LV_LOADP:
+        case FUSED_LV_CMOV_LOADP:
+                return LV;
+        case FUSED_NAND_NAND:
+        case FUSED_NAND_NAND_NAND:
+                return NAND;
+        default:
+                return opcode;
+        }
+}
+
+/*
+ * Name: fusedLength
+ * Purpose: Get the number of instructions an unpacked opcode runs
+ * Parameters: An opcode from the unpacked form of segment 0
+ * Returns: 1 for a plain instruction, the length of the sequence for a
+ *          superinstruction
+ * Notes: None
+ */
+unsigned fusedLength(unsigned opcode)
+{
+        switch (opcode) {
+        case FUSED_LV_SLOAD:
+        case FUSED_LV_SSTORE:
+        case FUSED_LV_LV:
+        case FUSED_LV_LOADP:
+        case FUSED_NAND_NAND:
+                return 2;
+        case FUSED_NAND_NAND_NAND:
+        case FUSED_LV_CMOV_LOADP:
+                return 3;
+        default:
+                return 1;
+        }
+}
+
+/*
+ * Name: fuseOpcodes
+ * Purpose: Find the opcode a sequence of instructions is run with
+ * Parameters: The opcodes of an instruction and the two after it, each
+ *             NO_OPCODE if there is no such instruction
+ * Returns: The fused opcode if the instructions start a known sequence, and
+ *          the first opcode otherwise
+ * Notes: The sequences are the idioms UM compilers emit most: a constant
+ *        loaded just before it is used as a segment offset or a jump
+ *        target, a CMOV choosing a jump target, constants built from two
+ *        LVs, and the NAND pairs and triples that make AND and OR. Longer
+ *        sequences are preferred. No sequence is longer than
+ *        MAX_FUSED_LENGTH
+ */
+unsigned fuseOpcodes(unsigned first, unsigned second, unsigned third)
+{
+        if (first == LV) {
+                if (second == CMOV && third == LOADP) {
+                        return FUSED_LV_CMOV_LOADP;
+                }
+                switch (second) {
+                case SLOAD:
+                        return FUSED_LV_SLOAD;
+                case SSTORE:
+                        return FUSED_LV_SSTORE;
+                case LV:
+                        return FUSED_LV_LV;
+                case LOADP:
+                        return FUSED_LV_LOADP;
+                default:
+                        return LV;
+                }
+        }
+        if (first == NAND && second == NAND) {
+                return third == NAND ? FUSED_NAND_NAND_NAND
+                                     : FUSED_NAND_NAND;
+        }
+        return first;
+}
+
+/*
+ * Name: setCheckpointPath
+ * Purpose: Ask for a checkpoint to be saved the first time input would block
+ * Parameters: The struct containing the memory structures and variables, the
+ *             file to save it to, or NULL to cancel
+ * Returns: None
+ * Notes: The path is not copied
+ */
+void setCheckpointPath(memoryInfo memory, const char *path)
+{
+        memory->checkpointPath = path;
+}
+
+/*
+ * Name: getCheckpointPath
+ * Purpose: Get the file a pending checkpoint will be saved to
+ * Parameters: The struct containing the memory structures and variables
+ * Returns: The path, or NULL if no checkpoint is pending
+ * Notes: None
+ */
+const char *getCheckpointPath(memoryInfo memory)
+{
+        return memory->checkpointPath;
+}
+
+/*
+ * Name: saveCheckpoint
+ * Purpose: Write the registers, program counter, every segment and the free
+ *          IDs to a checkpoint image
+ * Parameters: The struct containing the memory structures and variables, the
+ *             file to write, the output produced so far and its length
+ * Returns: True if the whole image was written
+ * Notes: The program resumes at the current program counter. Segment 0 is
+ *        written once even when a mapped ID shares it
+ */
+bool saveCheckpoint(memoryInfo memory, const char *path,
+                    const uint8_t *output, size_t outputLength)
+{
+        FILE *file = fopen(path, "wb");
+        if (file == NULL) {
+                return false;
+        }
+
+        checkpointHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+        header.programCounter = memory->programCounter;
+        header.maxSegmentID = memory->maxSegmentID;
+        header.numFreeIDs = memory->numFreeIDs;
+        header.outputLength = outputLength;
+        memcpy(header.allRegs, memory->allRegs, sizeof(header.allRegs));
+
+        /* Work out where each segment will go before writing anything */
+        uint32_t numIDs = memory->maxSegmentID;
+        uint64_t *offsets = CALLOC(numIDs, sizeof(uint64_t));
+        size_t offset = sizeof(header) + alignCheckpoint(outputLength) +
+                        alignCheckpoint(memory->numFreeIDs * sizeof(uint32_t)) +
+                        numIDs * sizeof(uint64_t);
+        for (uint32_t i = 0; i < numIDs; i++) {
+                segmentInfo segment = (memory->segments)[i];
+                if (segment == NULL) {
+                        continue;
+                }
+                if (i > 0 && segment == (memory->segments)[0]) {
+                        offsets[i] = offsets[0];
+                        continue;
+                }
+                offsets[i] = offset;
+                offset += alignCheckpoint(segmentBytes(segment->length));
+        }
+
+        bool ok = writePadded(file, &header, sizeof(header)) &&
+                  writePadded(file, output, outputLength) &&
+                  writePadded(file, memory->freeIDs,
+                              memory->numFreeIDs * sizeof(uint32_t)) &&
+                  writePadded(file, offsets, numIDs * sizeof(uint64_t));
+        for (uint32_t i = 0; ok && i < numIDs; i++) {
+                segmentInfo segment = (memory->segments)[i];
+                if (segment == NULL ||
+                    (i > 0 && segment == (memory->segments)[0])) {
+                        continue;
+                }
+                ok = writePadded(file, segment,
+                                 segmentBytes(segment->length));
+        }
+
+        FREE(offsets);
+        if (fclose(file) != 0) {
+                ok = false;
+        }
+        return ok;
+}
+
+/*
+ * Name: restoreCheckpoint
+ * Purpose: Rebuild UM memory from a checkpoint image
+ * Parameters: The image file, pointers to store the output that came before
+ *             the checkpoint and its length in
+ * Returns: The restored memory, or NULL if the file is not a valid image
+ * Notes: The image is mapped copy-on-write and segments are used where they
+ *        lie in it, so restoring does not read the segments. The output
+ *        pointer is valid until freeMemory
+ */
+memoryInfo restoreCheckpoint(const char *path, const uint8_t **output,
+                             size_t *outputLength)
+{
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+                return NULL;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 ||
+            (size_t) info.st_size < sizeof(checkpointHeader)) {
+                close(fd);
+                return NULL;
+        }
+        size_t imageSize = info.st_size;
+        uint8_t *image = mmap(NULL, imageSize, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (image == MAP_FAILED) {
+                return NULL;
+        }
+
+        /* Check that every part the header describes is inside the file */
+        checkpointHeader header;
+        memcpy(&header, image, sizeof(header));
+        uint32_t numIDs = header.maxSegmentID;
+        size_t freeIDsStart = sizeof(header) +
+                              alignCheckpoint(header.outputLength);
+        size_t offsetsStart = freeIDsStart +
+                alignCheckpoint((size_t) header.numFreeIDs * sizeof(uint32_t));
+        size_t segmentsStart = offsetsStart + numIDs * sizeof(uint64_t);
+        if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+            numIDs == 0 || header.numFreeIDs >= numIDs ||
+            header.outputLength > imageSize || segmentsStart > imageSize) {
+                munmap(image, imageSize);
+                return NULL;
+        }
+        const uint64_t *offsets = (const uint64_t *) (image + offsetsStart);
+        for (uint32_t i = 0; i < numIDs; i++) {
+                if (offsets[i] == 0) {
+                        continue;
+                }
+                if (offsets[i] < segmentsStart ||
+                    offsets[i] % CHECKPOINT_ALIGN != 0 ||
+                    offsets[i] > imageSize - sizeof(struct segmentInfo) ||
+                    segmentBytes(((segmentInfo) (image + offsets[i]))->length)
+                                > imageSize - offsets[i]) {
+                        munmap(image, imageSize);
+                        return NULL;
+                }
+        }
+        const uint32_t *freeIDs = (const uint32_t *) (image + freeIDsStart);
+        bool valid = offsets[0] != 0;
+        for (uint32_t i = 0; valid && i < header.numFreeIDs; i++) {
+                valid = freeIDs[i] != 0 && freeIDs[i] < numIDs &&
+                        offsets[freeIDs[i]] == 0;
+        }
+        if (!valid) {
+                munmap(image, imageSize);
+                return NULL;
+        }
+
+        memoryInfo memory = allocOrFail(1, sizeof(struct memoryInfo));
+        memory->image = image;
+        memory->imageSize = imageSize;
+        memory->tableSize = INIT_TABLE_SIZE;
+        while (memory->tableSize < numIDs) {
+                memory->tableSize *= 2;
+        }
+        memory->segments = allocOrFail(memory->tableSize,
+                                       sizeof(segmentInfo));
+        memory->freeIDs = allocOrFail(memory->tableSize, sizeof(uint32_t));
+        memcpy(memory->freeIDs, freeIDs, header.numFreeIDs * sizeof(uint32_t));
+        memory->numFreeIDs = header.numFreeIDs;
+        memory->pool = makeSegPool();
+        memory->maxSegmentID = numIDs;
+        memory->programCounter = header.programCounter;
+        memcpy(memory->allRegs, header.allRegs, sizeof(memory->allRegs));
+        for (uint32_t i = 0; i < numIDs; i++) {
+                if (offsets[i] == 0) {
+                        continue;
+                }
+                segmentInfo segment = (segmentInfo) (image + offsets[i]);
+                (memory->segments)[i] = segment;
+
+                /* Segment 0 may be shared with a mapped ID */
+                if (i == 0 || segment != (memory->segments)[0]) {
+                        countAllocation(memory, segment->length);
+                }
+        }
+        memory->stats.peakFreeIDs = memory->numFreeIDs;
+        decodeProgram(memory);
+
+        *output = image + sizeof(header);
+        *outputLength = header.outputLength;
+        return memory;
+}
+
+/*
+ * Name: writeMemoryStats
+ * Purpose: Write what the segments hold, as JSON
+ * Parameters: The struct containing the memory structures and variables, the
+ *             file descriptor to write to
+ * Returns: None
+ * Notes: Gives the live, peak and allocated counts of segments and words, the
+ *        free ID stack, the highest ID and table growth, how many program
+ *        loads were decoded or memoized, and a histogram of segment sizes
+ *        by power of two, skipping sizes never allocated. Uses no stdio or
+ *        allocation. Only call it from the thread running the machine,
+ *        between instructions; a signal handler uses requestMemoryStats
+ */
+void writeMemoryStats(memoryInfo memory, int fd)
+{
+        const segmentStats *stats = &memory->stats;
+        statsBuffer buffer;
+        buffer.length = 0;
+
+        appendText(&buffer, "{\n");
+        appendCounts(&buffer, "segments", stats->liveSegments, "live",
+                     stats->peakSegments, "peak");
+        appendText(&buffer, "  \"segments_allocated\": ");
+        appendNumber(&buffer, stats->allocatedSegments);
+        appendText(&buffer, ",\n");
+        appendCounts(&buffer, "words", stats->liveWords, "live",
+                     stats->peakWords, "peak");
+        appendCounts(&buffer, "free_ids", memory->numFreeIDs, "depth",
+                     stats->peakFreeIDs, "peak_depth");
+        appendText(&buffer, "  \"max_segment_id\": ");
+        appendNumber(&buffer, memory->maxSegmentID);
+        appendText(&buffer, ",\n");
+        appendCounts(&buffer, "table", memory->tableSize, "size",
+                     stats->tableGrowths, "growths");
+        appendCounts(&buffer, "program_loads",
+                     stats->programLoads - stats->memoizedLoads, "decoded",
+                     stats->memoizedLoads, "memoized");
+
+        appendText(&buffer, "  \"segment_sizes\": [");
+        const char *separator = "\n";
+        for (unsigned class = 0; class < NUM_SIZE_CLASSES; class++) {
+                if ((stats->allocatedBySize)[class] == 0) {
+                        continue;
+                }
+                uint64_t maxWords = ((uint64_t) 1 << class) - 1;
+                uint64_t minWords = (maxWords + 1) / 2;
+                appendText(&buffer, separator);
+                appendText(&buffer, "    {\"min_words\": ");
+                appendNumber(&buffer, minWords);
+                appendText(&buffer, ", \"max_words\": ");
+                appendNumber(&buffer, maxWords);
+                appendText(&buffer, ", \"allocated\": ");
+                appendNumber(&buffer, (stats->allocatedBySize)[class]);
+                appendText(&buffer, ", \"live\": ");
+                appendNumber(&buffer, (stats->liveBySize)[class]);
+                appendText(&buffer, "}");
+                separator = ",\n";
+        }
+        appendText(&buffer, "\n  ]\n}\n");
+
+        size_t written = 0;
+        while (written < buffer.length) {
+                ssize_t result = write(fd, buffer.text + written,
+                                       buffer.length - written);
+                if (result <= 0) {
+                        return;
+                }
+                written += result;
+        }
+}
+
+/*
+ * Name: requestMemoryStats
+ * Purpose: Ask for the memory statistics to be written soon
+ * Parameters: None
+ * Returns: None
+ * Notes: Only sets a flag, so a signal handler may call it. The machine
+ *        writes the statistics at its next map, unmap, program load or
+ *        input (see writeRequestedStats), where they are consistent
+ */
+void requestMemoryStats(void)
+{
+        statsRequested = 1;
+}
+
+/*
+ * Name: writeRequestedStats
+ * Purpose: Write the memory statistics if requestMemoryStats asked for them
+ * Parameters: The struct containing the memory structures and variables, the
+ *             file descriptor to write to
+ * Returns: None
+ * Notes: Called by the command loops between instructions. Costs one load
+ *        when nothing was asked for
+ */
+void writeRequestedStats(memoryInfo memory, int fd)
+{
+        if (statsRequested) {
+                statsRequested = 0;
+                writeMemoryStats(memory, fd);
+        }
+}
+
+/*
+ * Name: printSegmentFault
+ * Purpose: Describe a bad segment access in terms of the UM program
+ * Parameters: The struct containing the memory structures and variables, the
+ *             segment ID and offset the access was made to, the stream to
+ *             print to
+ * Returns: None
+ * Notes: The program counter must be at the instruction that made the access
+ */
+void printSegmentFault(memoryInfo memory, uint32_t id, uint32_t offset,
+                       FILE *out)
+{
+        uint32_t instruction = memory->programCounter;
+        if (id >= memory->maxSegmentID || (memory->segments)[id] == NULL) {
+                fprintf(out, "um: instruction %u used segment %u, which is "
+                        "not mapped\n", instruction, id);
+                return;
+        }
+        fprintf(out, "um: instruction %u used offset %u of segment %u, "
+                "which has %u words\n", instruction, offset, id,
+                (memory->segments)[id]->length);
+}
+
 /*
  * Name: freeMemory
  * Purpose: Free the memory of the UM
  * Parameters: The struct containing the memory structures and variables
  * Returns: None
- * Notes: None
+ * Notes: Only segments too large for the pool are freed one by one; the rest
+ *        go when the pool is freed or the checkpoint image is unmapped.
+ *        Building with -DUM_DEBUG_STATS prints the pool's hit rates first.
+ *        Also frees memory that makeMemoryInfo only partly built
  */
 void freeMemory(memoryInfo memory)
 {
-        freeSeqMemory(memory->recentlyUnmapped);
-        freeSeqMemory(memory->mainMemory);
-        FREE(memory->program);
-        FREE(memory);
+        /*
+         * Large segments may be shared with segment 0, so release rather than
+         * free them
+         */
+        for (uint32_t i = 0; i < memory->maxSegmentID; i++) {
+                segmentInfo segment = (memory->segments)[i];
+                if (segment != NULL && !inImage(memory, segment) &&
+                    poolIsLarge(segmentBytes(segment->length))) {
+                        releaseSegment(memory, segment);
+                }
+        }
+        if (memory->pool != NULL) {
+#ifdef UM_DEBUG_STATS
+                poolPrintStats(memory->pool, stderr);
+#endif
+                freeSegPool(memory->pool);
+        }
+        free(memory->segments);
+        free(memory->freeIDs);
+        free(memory->decoded);
+        freeOptimized(memory);
+        if (memory->image != NULL) {
+                munmap(memory->image, memory->imageSize);
+        }
+        free(memory);
 }
 
 /*
- * Name: freeSeqMemory
- * Purpose: Free memory of elements in the sequence and the sequence itself
- * Parameters: The sequence to free
+ * Name: decodeInstruction
+ * Purpose: Unpack the opcode, registers and value of an instruction
+ * Parameters: The instruction
+ * Returns: The unpacked instruction
+ * Notes: Uses shifts and masks rather than Bitpack since it runs once for
+ *        every word of every program that gets loaded
+ */
+static Um_decoded decodeInstruction(Um_instruction instruction)
+{
+        Um_decoded decoded;
+        decoded.opcode = instruction >> OPCODE_LSB;
+        if (decoded.opcode == LV) {
+                decoded.a = (instruction >> LV_REG_LSB) & REG_MASK;
+                decoded.b = 0;
+                decoded.c = 0;
+                decoded.value = instruction & LV_VALUE_MASK;
+        }
+        else {
+                decoded.a = (instruction >> 6) & REG_MASK;
+                decoded.b = (instruction >> 3) & REG_MASK;
+                decoded.c = instruction & REG_MASK;
+                decoded.value = 0;
+        }
+        return decoded;
+}
+
+/*
+ * Name: decodeProgram
+ * Purpose: Build the unpacked form of segment 0
+ * Parameters: The struct containing the memory structures and variables
  * Returns: None
+ * Notes: Frees the unpacked and optimized forms of the previous program,
+ *        if any. Every instruction that starts a sequence fusedOpcode knows
+ *        gets the fused opcode
+ */
+static void decodeProgram(memoryInfo memory)
+{
+        segmentInfo program = (memory->segments)[0];
+        uint32_t length = program->length;
+        /*
+         * Allocate at least one entry so an empty program is not NULL, and
+         * before freeing the old form so a failure leaves nothing dangling
+         */
+        Um_decoded *decoded = allocOrFail((size_t) length + 1,
+                                          sizeof(Um_decoded));
+        free(memory->decoded);
+        memory->decoded = decoded;
+        for (uint32_t i = 0; i < length; i++) {
+                (memory->decoded)[i] =
+                        decodeInstruction((program->segData)[i]);
+                (memory->decoded)[i].opcode = fusedOpcode(program, i);
+        }
+        /*
+         * Optimizing costs several passes over the program, which a program
+         * that is loaded, runs briefly and loads another never pays back
+         */
+        freeOptimized(memory);
+        if (memory->optimize) {
+                memory->jumpsToOptimize = OPTIMIZE_AFTER_JUMPS;
+        }
+}
+
+/*
+ * Name: optimizeLoadedProgram
+ * Purpose: Optimize a program loadProgram loaded once it has run for a while
+ * Parameters: The struct containing the memory structures and variables
+ * Returns: None
+ * Notes: Called by countJump when the program has made OPTIMIZE_AFTER_JUMPS
+ *        jumps within segment 0. Any form of segment 0 the caller is running
+ *        from must be chosen again with programAt afterwards
+ */
+void optimizeLoadedProgram(memoryInfo memory)
+{
+        memory->jumpsToOptimize = 0;
+        buildOptimized(memory);
+}
+
+/*
+ * Name: buildOptimized
+ * Purpose: Build the optimized form of segment 0 from the unpacked one
+ * Parameters: The struct containing the memory structures and variables
+ * Returns: None
+ * Notes: Frees the optimized form of the previous program, if any
+ */
+static void buildOptimized(memoryInfo memory)
+{
+        uint32_t length = (memory->segments)[0]->length;
+        freeOptimized(memory);
+        memory->optimized = CALLOC(length + 1, sizeof(Um_decoded));
+        memory->blockFlags = CALLOC(length + 1, sizeof(uint8_t));
+        optimizeProgram(memory->decoded, length, memory->optimized,
+                        memory->blockFlags);
+}
+
+/*
+ * Name: freeOptimized
+ * Purpose: Free the optimized form of segment 0
+ * Parameters: The struct containing the memory structures and variables
+ * Returns: None
+ * Notes: Leaves optimized and blockFlags NULL, so the plain unpacked form is
+ *        run until buildOptimized makes a new one
+ */
+static void freeOptimized(memoryInfo memory)
+{
+        if (memory->optimized != NULL) {
+                FREE(memory->optimized);
+                FREE(memory->blockFlags);
+        }
+}
+
+/*
+ * Name: fusedOpcode
+ * Purpose: Find the opcode an instruction of segment 0 is run with
+ * Parameters: Segment 0, the index of the instruction
+ * Returns: The fused opcode if the instruction starts a known sequence, and
+ *          its own opcode otherwise
  * Notes: None
  */
-void freeSeqMemory(Seq_T seq)
+static unsigned fusedOpcode(segmentInfo program, uint32_t index)
 {
-        /* If the entry in the sequence is not null, free its memory */
-        void *currEntry;
-        for(int i = 0; i < Seq_length(seq); i++) {
-                currEntry = Seq_get(seq, i);
-                if (currEntry != NULL) {
-                        FREE(currEntry);
-                }
+        return fuseOpcodes(opcodeAt(program, index),
+                           opcodeAt(program, index + 1),
+                           opcodeAt(program, index + 2));
+}
+
+/*
+ * Name: opcodeAt
+ * Purpose: Get the opcode of a word of segment 0
+ * Parameters: Segment 0, the index of the word
+ * Returns: The opcode, or NO_OPCODE past the end of the segment
+ * Notes: None
+ */
+static inline unsigned opcodeAt(segmentInfo program, uint64_t index)
+{
+        if (index >= program->length) {
+                return NO_OPCODE;
         }
+        return (program->segData)[index] >> OPCODE_LSB;
+}
+
+/*
+ * Name: segmentBytes
+ * Purpose: Get the number of bytes a segment takes up
+ * Parameters: The number of words in the segment
+ * Returns: The size of the segment's header and words
+ * Notes: None
+ */
+static inline size_t segmentBytes(uint32_t length)
+{
+        return sizeof(struct segmentInfo) + (size_t) length * sizeof(uint32_t);
+}
 
-        Seq_free(&seq);
-}
\ No newline at end of file
+/*
+ * Name: newSegment
+ * Purpose: Allocate a segment with every word set to 0
+ * Parameters: The struct containing the memory structures and variables, the
+ *             number of words in the segment
+ * Returns: The new segment, used in one place
+ * Notes: Recycled blocks are zeroed only as far as the segment reaches. Freed
+ *        by releaseSegment
+ */
+static segmentInfo newSegment(memoryInfo memory, uint32_t length)
+{
+        bool zeroed;
+        segmentInfo segment = poolAlloc(memory->pool, segmentBytes(length),
+                                        &zeroed);
+        if (!zeroed) {
+                memset(segment->segData, 0, (size_t) length * sizeof(uint32_t));
+        }
+        segment->length = length;
+        segment->refCount = 1;
+        countAllocation(memory, length);
+        return segment;
+}
+
+/*
+ * Name: unshareSegment
+ * Purpose: Give one user of a shared segment its own copy
+ * Parameters: The struct containing the memory structures and variables, the
+ *             shared segment
+ * Returns: A copy of the segment, used in one place
+ * Notes: The caller must put the copy wherever it got the shared segment from
+ */
+static segmentInfo unshareSegment(memoryInfo memory, segmentInfo segment)
+{
+        bool zeroed;
+        segmentInfo copy = poolAlloc(memory->pool,
+                                     segmentBytes(segment->length), &zeroed);
+        memcpy(copy->segData, segment->segData,
+               (size_t) segment->length * sizeof(uint32_t));
+        PROFILE_COPY((size_t) segment->length * sizeof(uint32_t));
+        copy->length = segment->length;
+        copy->refCount = 1;
+        (segment->refCount)--;
+        countAllocation(memory, copy->length);
+        return copy;
+}
+
+/*
+ * Name: releaseSegment
+ * Purpose: Stop using a segment, giving it back to the pool if nothing else
+ *          uses it
+ * Parameters: The struct containing the memory structures and variables, the
+ *             segment
+ * Returns: None
+ * Notes: Segments inside a checkpoint image are left where they are, but
+ *        stop counting as live
+ */
+static void releaseSegment(memoryInfo memory, segmentInfo segment)
+{
+        (segment->refCount)--;
+        if (segment->refCount != 0) {
+                return;
+        }
+        countRelease(memory, segment->length);
+        if (!inImage(memory, segment)) {
+                poolFree(memory->pool, segment, segmentBytes(segment->length));
+        }
+}
+
+/*
+ * Name: growTable
+ * Purpose: Double the room in the segment table and the free ID stack
+ * Parameters: The struct containing the memory structures and variables
+ * Returns: None
+ * Notes: The free ID stack is kept as large as the table, so unmapSeg can
+ *        always push without checking
+ */
+static void growTable(memoryInfo memory)
+{
+        uint32_t oldSize = memory->tableSize;
+        uint32_t newSize = oldSize * 2;
+        memory->segments = resizeOrFail(memory->segments,
+                                        newSize * sizeof(segmentInfo));
+        memset(memory->segments + oldSize, 0,
+               (newSize - oldSize) * sizeof(segmentInfo));
+        memory->freeIDs = resizeOrFail(memory->freeIDs,
+                                       newSize * sizeof(uint32_t));
+        memory->tableSize = newSize;
+}
+
+/*
+ * Name: alignCheckpoint
+ * Purpose: Round a size up to where the next part of a checkpoint image
+ *          starts
+ * Parameters: The size
+ * Returns: The size rounded up to a multiple of CHECKPOINT_ALIGN
+ * Notes: None
+ */
+static inline size_t alignCheckpoint(size_t size)
+{
+        return (size + CHECKPOINT_ALIGN - 1) & ~(size_t) (CHECKPOINT_ALIGN - 1);
+}
+
+/*
+ * Name: writePadded
+ * Purpose: Write one part of a checkpoint image
+ * Parameters: The image file, the bytes to write and how many there are
+ * Returns: True if everything was written
+ * Notes: Pads with zeros up to the start of the next part
+ */
+static bool writePadded(FILE *file, const void *data, size_t size)
+{
+        static const uint8_t zeros[CHECKPOINT_ALIGN] = {0};
+        size_t padding = alignCheckpoint(size) - size;
+        return (size == 0 || fwrite(data, 1, size, file) == size) &&
+               (padding == 0 || fwrite(zeros, 1, padding, file) == padding);
+}
+
+/*
+ * Name: inImage
+ * Purpose: Say whether a segment lives in the checkpoint image
+ * Parameters: The struct containing the memory structures and variables, the
+ *             segment
+ * Returns: True if the segment was restored from the image and never copied
+ * Notes: None
+ */
+static inline bool inImage(memoryInfo memory, segmentInfo segment)
+{
+        uint8_t *address = (uint8_t *) segment;
+        return address >= memory->image &&
+               address < memory->image + memory->imageSize;
+}
+
+/*
+ * Name: sizeClassOf
+ * Purpose: Find the segmentStats size class of a segment
+ * Parameters: The number of words in the segment
+ * Returns: 0 for an empty segment, otherwise the number of bits in the length
+ * Notes: None
+ */
+static inline unsigned sizeClassOf(uint32_t length)
+{
+        return length == 0 ? 0 : 32 - __builtin_clz(length);
+}
+
+/*
+ * Name: countAllocation
+ * Purpose: Count a newly allocated segment in the memory statistics
+ * Parameters: The struct containing the memory structures and variables, the
+ *             number of words in the segment
+ * Returns: None
+ * Notes: None
+ */
+static void countAllocation(memoryInfo memory, uint32_t length)
+{
+        segmentStats *stats = &memory->stats;
+        unsigned class = sizeClassOf(length);
+        (stats->liveSegments)++;
+        (stats->allocatedSegments)++;
+        stats->liveWords += length;
+        (stats->allocatedBySize)[class]++;
+        (stats->liveBySize)[class]++;
+        if (stats->liveSegments > stats->peakSegments) {
+                stats->peakSegments = stats->liveSegments;
+        }
+        if (stats->liveWords > stats->peakWords) {
+                stats->peakWords = stats->liveWords;
+        }
+}
+
+/*
+ * Name: countRelease
+ * Purpose: Stop counting a segment that nothing uses any more
+ * Parameters: The struct containing the memory structures and variables, the
+ *             number of words in the segment
+ * Returns: None
+ * Notes: None
+ */
+static void countRelease(memoryInfo memory, uint32_t length)
+{
+        segmentStats *stats = &memory->stats;
+        (stats->liveSegments)--;
+        stats->liveWords -= length;
+        (stats->liveBySize)[sizeClassOf(length)]--;
+}
+
+/*
+ * Name: appendText
+ * Purpose: Add a string to the end of the statistics being written
+ * Parameters: The buffer, the string
+ * Returns: None
+ * Notes: Whatever does not fit is dropped
+ */
+static void appendText(statsBuffer *buffer, const char *text)
+{
+        while (*text != '\0' && buffer->length < STATS_BUFFER_SIZE) {
+                (buffer->text)[buffer->length] = *text;
+                (buffer->length)++;
+                text++;
+        }
+}
+
+/*
+ * Name: appendNumber
+ * Purpose: Add a number in decimal to the end of the statistics being written
+ * Parameters: The buffer, the number
+ * Returns: None
+ * Notes: Written by hand because snprintf is not safe in a signal handler
+ */
+static void appendNumber(statsBuffer *buffer, uint64_t number)
+{
+        char digits[21];
+        int i = sizeof(digits) - 1;
+        digits[i] = '\0';
+        do {
+                i--;
+                digits[i] = '0' + number % 10;
+                number /= 10;
+        } while (number != 0);
+        appendText(buffer, digits + i);
+}
+
+/*
+ * Name: appendCounts
+ * Purpose: Add a member holding an object of two numbers
+ * Parameters: The buffer, the member's name, then each number and its name
+ * Returns: None
+ * Notes: The member is followed by a comma, so it cannot be the last one
+ */
+static void appendCounts(statsBuffer *buffer, const char *name,
+                         uint64_t first, const char *firstName,
+                         uint64_t second, const char *secondName)
+{
+        appendText(buffer, "  \"");
+        appendText(buffer, name);
+        appendText(buffer, "\": {\"");
+        appendText(buffer, firstName);
+        appendText(buffer, "\": ");
+        appendNumber(buffer, first);
+        appendText(buffer, ", \"");
+        appendText(buffer, secondName);
+        appendText(buffer, "\": ");
+        appendNumber(buffer, second);
+        appendText(buffer, "},\n");
+}
@@ -13,8 +13,8 @@
 #ifndef MEMORY_INCLUDED
 #define MEMORY_INCLUDED
 
+#include <stdbool.h>
 #include <stdio.h>
-#include "seq.h"
 #include "mem.h"
 #include "bitpack.h"
 #include <assert.h>
@@ -22,19 +22,88 @@
 typedef uint32_t Um_instruction;
 typedef struct memoryInfo *memoryInfo;
 
-memoryInfo makeMemoryInfo(uint32_t numInstructions, FILE *commandFile);
+typedef enum Um_opcode {
+        CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV,
+        NAND, HALT, ACTIVATE, INACTIVATE, OUT, IN, LOADP, LV
+} Um_opcode;
+
+/*
+ * Superinstructions. The unpacked form of an instruction that starts one of
+ * these sequences carries the fused opcode instead of its own, and runs the
+ * whole sequence at once. The instructions after it keep their own unpacked
+ * form, which the fused handler reads its operands from
+ */
+typedef enum Um_fused {
+        FUSED_LV_SLOAD = 16, FUSED_LV_SSTORE, FUSED_LV_LV, FUSED_LV_LOADP,
+        FUSED_NAND_NAND, FUSED_NAND_NAND_NAND, FUSED_LV_CMOV_LOADP
+} Um_fused;
+
+/*
+ * Instructions only the optimized form of segment 0 has (see optimize.c).
+ * OPT_SKIP jumps over the value - 1 words after it, which the optimizer
+ * dropped. The others are an LV, a move and the single instruction forms of
+ * the NAND idioms for AND and OR, each of which jumps over the dropped words
+ * right after it: as many as b says for OPT_LV and value for the rest
+ */
+typedef enum Um_optimized {
+        OPT_SKIP = FUSED_LV_CMOV_LOADP + 1, OPT_LV, OPT_AND, OPT_OR, OPT_MOV,
+        NUM_DECODED_OPCODES
+} Um_optimized;
+
+/* Stands for the words past the end of segment 0 when fusing */
+#define NO_OPCODE 16
+
+/*
+ * Name: Um_decoded
+ * Purpose: An instruction from segment 0 with its fields already unpacked
+ * Members: opcode - The instruction's opcode
+ *          a, b, c - The register numbers (for LV only a is meaningful)
+ *          value - The value loaded by LV, or how far an optimized
+ *                  instruction jumps (see Um_optimized)
+ */
+typedef struct Um_decoded {
+        uint8_t opcode;
+        uint8_t a;
+        uint8_t b;
+        uint8_t c;
+        uint32_t value;
+} Um_decoded;
+
+memoryInfo makeMemoryInfo(const uint8_t *programBytes,
+                          uint32_t numInstructions);
+bool startRecycler(memoryInfo memory);
+void enableOptimizer(memoryInfo memory);
+void printSegmentFault(memoryInfo memory, uint32_t id, uint32_t offset,
+                       FILE *out);
 Um_instruction getCurrInstruction(memoryInfo memory);
+const Um_decoded *getCurrDecoded(memoryInfo memory);
 uint32_t getRegisterValue(memoryInfo memory, uint32_t regNum);
 void setRegisterValue(memoryInfo memory, uint32_t regNum, uint32_t value);
-void loadInitialProgram(memoryInfo memory, int numInstructions,
-                                                        FILE *commandFile);
+void loadInitialProgram(memoryInfo memory, const uint8_t *programBytes,
+                        uint32_t numInstructions);
 void segLoad(uint32_t commandRegs[], memoryInfo memory);
 void segStore(uint32_t commandRegs[], memoryInfo memory);
 void mapSeg(uint32_t commandRegs[], memoryInfo memory);
 void unmapSeg(uint32_t commandRegs[], memoryInfo memory);
 void loadProgram(uint32_t commandRegs[],  memoryInfo memory);
 void incrementProgramCounter(memoryInfo memory);
+uint32_t getProgramCounter(memoryInfo memory);
+void setProgramCounter(memoryInfo memory, uint32_t programCounter);
+uint32_t *getRegisterFile(memoryInfo memory);
+const Um_decoded *getDecodedProgram(memoryInfo memory, uint32_t *length);
+uint32_t getProgramVersion(memoryInfo memory);
+Um_opcode baseOpcode(unsigned opcode);
+unsigned fusedLength(unsigned opcode);
+unsigned fuseOpcodes(unsigned first, unsigned second, unsigned third);
+void setCheckpointPath(memoryInfo memory, const char *path);
+const char *getCheckpointPath(memoryInfo memory);
+bool saveCheckpoint(memoryInfo memory, const char *path,
+                    const uint8_t *output, size_t outputLength);
+memoryInfo restoreCheckpoint(const char *path, const uint8_t **output,
+                             size_t *outputLength);
+void writeMemoryStats(memoryInfo memory, int fd);
+void requestMemoryStats(void);
+void writeRequestedStats(memoryInfo memory, int fd);
 void freeMemory(memoryInfo memory);
-void freeSeqMemory(Seq_T seq);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,877 @@
+/**************************************************************
+ *
+ *                     optimize.c
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Implementation of the load-time optimizer, which
+ *              builds a second unpacked form of segment 0 for
+ *              ./um --optimize.
+ *
+ *              Segment 0 is cut into blocks. A block starts at the
+ *              first word, after every LOADP, HALT, IN and OUT, and at
+ *              the words LVs name (the likely jump targets), and is no
+ *              longer than MAX_BLOCK_LENGTH words. Blocks never start
+ *              inside a superinstruction. Each block is lifted into
+ *              a small register IR, where constants are folded, the
+ *              NAND idioms for AND and OR become single instructions,
+ *              and writes no instruction reads are dropped. Register
+ *              arithmetic moves up over the words dropped before it,
+ *              so they end up after an instruction that can jump over
+ *              them as it runs, or failing that behind one OPT_SKIP.
+ *              The result is fused into superinstructions again and
+ *              written over the block.
+ *
+ *              The interpreter only enters the optimized form at the
+ *              start of a block, and runs the plain form after a jump
+ *              anywhere else. So that it can carry on in the plain
+ *              form at any point, every register is written as the
+ *              plain form would have written it by the end of a block
+ *              and before every SSTORE. A store into a block puts the
+ *              block back to its plain form.
+ *
+ **************************************************************/
+
+#include <stdbool.h>
+#include <string.h>
+#include "optimize.h"
+
+/* Macro Definitions */
+#define MAX_BLOCK_LENGTH 256
+#define NUM_REGS 8
+#define ALL_REGS 0xff
+#define REG_BIT(reg) (1u << (reg))
+
+/* NOT only exists in the IR, and goes back to being a NAND */
+#define IR_NOT NUM_DECODED_OPCODES
+
+/*
+ * Name: irInstruction
+ * Purpose: One instruction of a block being optimized
+ * Members: op - a Um_opcode, Um_optimized opcode or IR_NOT, never a fused
+ *               one
+ *          a, b, c - The register numbers, as in Um_decoded
+ *          value - The value loaded by LV, which may use all 32 bits
+ */
+typedef struct irInstruction {
+        unsigned op;
+        uint8_t a;
+        uint8_t b;
+        uint8_t c;
+        uint32_t value;
+} irInstruction;
+
+/* Function Declarations */
+static void findBlockStarts(const Um_decoded *decoded, uint32_t length,
+                            uint8_t *blockFlags);
+static uint32_t blockStart(const uint8_t *blockFlags, uint32_t index);
+static uint32_t blockEnd(const uint8_t *blockFlags, uint32_t length,
+                         uint32_t start);
+static bool splitsFused(const Um_decoded *decoded, uint32_t index);
+static bool optimizeBlock(const Um_decoded *decoded, Um_decoded *optimized,
+                          uint32_t start, uint32_t end);
+static void foldConstants(irInstruction *block, int length);
+static void combineLogic(irInstruction *block, int length);
+static void removeDeadWrites(irInstruction *block, int length);
+static void moveIntoSkips(irInstruction *block, int length);
+static void findLiveness(const irInstruction *block, int length,
+                         uint8_t *liveAfter);
+static void restoreBlock(const Um_decoded *decoded, Um_decoded *optimized,
+                         uint32_t start, uint32_t end);
+static void fuseBlock(Um_decoded *program, uint32_t from, uint32_t to,
+                      uint32_t end);
+static uint32_t countDispatches(const Um_decoded *program, uint32_t start,
+                                uint32_t end);
+static int lastWriter(const irInstruction *block, int index, unsigned reg);
+static bool unchangedSince(const irInstruction *block, int from, int to,
+                           unsigned reg);
+static bool readSince(const irInstruction *block, int from, int to,
+                      unsigned reg);
+static bool diesAt(const irInstruction *block, const uint8_t *liveAfter,
+                   int index, unsigned reg);
+static unsigned readsOf(const irInstruction *instruction);
+static unsigned writesOf(const irInstruction *instruction);
+static bool endsBlock(unsigned op);
+static bool isRegisterOnly(unsigned op);
+static inline void makeConstant(irInstruction *instruction, uint32_t value);
+static inline void makeMove(irInstruction *instruction, unsigned source);
+
+/*
+ * Name: optimizeProgram
+ * Purpose: Build the optimized form of segment 0
+ * Parameters: The unpacked form of segment 0, the number of words in it, an
+ *             array of length + 1 entries for the optimized form, an array of
+ *             length + 1 flags
+ * Returns: None
+ * Notes: Sets BLOCK_START for every word the optimized form may be entered
+ *        at, and BLOCK_OPTIMIZED for every word of a block that was changed
+ */
+void optimizeProgram(const Um_decoded *decoded, uint32_t length,
+                     Um_decoded *optimized, uint8_t *blockFlags)
+{
+        assert(decoded != NULL && optimized != NULL && blockFlags != NULL);
+        findBlockStarts(decoded, length, blockFlags);
+        optimized[length] = decoded[length];
+        uint32_t start = 0;
+        while (start < length) {
+                uint32_t end = blockEnd(blockFlags, length, start);
+                if (optimizeBlock(decoded, optimized, start, end)) {
+                        for (uint32_t i = start; i < end; i++) {
+                                blockFlags[i] |= BLOCK_OPTIMIZED;
+                        }
+                }
+                start = end;
+        }
+}
+
+/*
+ * Name: deoptimizeBlock
+ * Purpose: Put the block holding a word of segment 0 back to its plain form
+ * Parameters: The unpacked form of segment 0, the number of words in it, the
+ *             optimized form, where blocks start, the index of the word
+ * Returns: None
+ * Notes: Called after every store into segment 0, once the unpacked form has
+ *        been brought up to date. The plain form is right whatever the
+ *        optimized form has done so far, so this is safe while the block
+ *        is running. Once a block is plain, a store only copies the word
+ *        stored to, which keeps data kept in segment 0 cheap to write
+ */
+void deoptimizeBlock(const Um_decoded *decoded, uint32_t length,
+                     Um_decoded *optimized, uint8_t *blockFlags,
+                     uint32_t index)
+{
+        assert(index < length);
+        if (blockFlags[index] & BLOCK_OPTIMIZED) {
+                uint32_t start = blockStart(blockFlags, index);
+                uint32_t end = blockEnd(blockFlags, length, start);
+                restoreBlock(decoded, optimized, start, end);
+                for (uint32_t i = start; i < end; i++) {
+                        blockFlags[i] &= ~BLOCK_OPTIMIZED;
+                }
+                return;
+        }
+
+        /*
+         * Only the word and the two before it can fuse differently, and only
+         * if one of them starts a superinstruction in the plain form, since
+         * the end of a block can cut a sequence short but never makes one
+         */
+        uint32_t first = index;
+        while (first + 2 > index && !(blockFlags[first] & BLOCK_START)) {
+                first--;
+        }
+        bool fused = false;
+        for (uint32_t i = first; i <= index; i++) {
+                optimized[i] = decoded[i];
+                fused |= decoded[i].opcode >= FUSED_LV_SLOAD;
+        }
+        if (!fused) {
+                return;
+        }
+        uint32_t end = index + 1;
+        while (end < index + 3 && end < length &&
+               !(blockFlags[end] & BLOCK_START)) {
+                end++;
+        }
+        fuseBlock(optimized, first, index + 1, end);
+}
+
+/*
+ * Name: findBlockStarts
+ * Purpose: Decide where the blocks of segment 0 start
+ * Parameters: The unpacked form of segment 0, the number of words in it,
+ *             the flags to set
+ * Returns: None
+ * Notes: Words that are really data are cut into blocks like code, which
+ *        does no harm since they are never run. A word an LV names that is
+ *        inside a superinstruction does not start a block, since a jump there
+ *        is rare and the block would lose the superinstruction. Blocks that
+ *        are too long are cut at the last word that is not inside one,
+ *        unless that would leave less than half of MAX_BLOCK_LENGTH
+ */
+static void findBlockStarts(const Um_decoded *decoded, uint32_t length,
+                            uint8_t *blockFlags)
+{
+        memset(blockFlags, 0, length + 1);
+        blockFlags[0] = BLOCK_START;
+        for (uint32_t i = 0; i < length; i++) {
+                unsigned op = baseOpcode(decoded[i].opcode);
+                uint32_t target = decoded[i].value;
+                if (endsBlock(op)) {
+                        blockFlags[i + 1] = BLOCK_START;
+                } else if (op == LV && target < length &&
+                           !splitsFused(decoded, target)) {
+                        blockFlags[target] = BLOCK_START;
+                }
+        }
+
+        uint32_t start = 0;
+        for (uint32_t i = 1; i < length; i++) {
+                if (blockFlags[i] & BLOCK_START) {
+                        start = i;
+                } else if (i - start == MAX_BLOCK_LENGTH) {
+                        uint32_t cut = i;
+                        while (cut > start + MAX_BLOCK_LENGTH / 2 &&
+                               splitsFused(decoded, cut)) {
+                                cut--;
+                        }
+                        if (splitsFused(decoded, cut)) {
+                                cut = i;
+                        }
+                        blockFlags[cut] = BLOCK_START;
+                        start = cut;
+                }
+        }
+        blockFlags[length] = 0;
+}
+
+/*
+ * Name: blockStart
+ * Purpose: Find where the block holding a word starts
+ * Parameters: The flags for segment 0, the index of the word
+ * Returns: The index of the block's first word
+ * Notes: None
+ */
+static uint32_t blockStart(const uint8_t *blockFlags, uint32_t index)
+{
+        while (!(blockFlags[index] & BLOCK_START)) {
+                index--;
+        }
+        return index;
+}
+
+/*
+ * Name: blockEnd
+ * Purpose: Find where a block ends
+ * Parameters: Where blocks start, the number of words in segment 0, the
+ *             index the block starts at
+ * Returns: The index just past the block's last word
+ * Notes: None
+ */
+static uint32_t blockEnd(const uint8_t *blockFlags, uint32_t length,
+                         uint32_t start)
+{
+        uint32_t end = start + 1;
+        while (end < length && !(blockFlags[end] & BLOCK_START)) {
+                end++;
+        }
+        return end;
+}
+
+/*
+ * Name: splitsFused
+ * Purpose: Check whether a block starting at a word would split a
+ *          superinstruction of the plain form
+ * Parameters: The unpacked form of segment 0, the index of the word
+ * Returns: True if a superinstruction starting before the word runs it
+ * Notes: None
+ */
+static bool splitsFused(const Um_decoded *decoded, uint32_t index)
+{
+        return (index >= 1 && fusedLength(decoded[index - 1].opcode) >= 2) ||
+               (index >= 2 && fusedLength(decoded[index - 2].opcode) >= 3);
+}
+
+/*
+ * Name: optimizeBlock
+ * Purpose: Write the optimized form of one block
+ * Parameters: The unpacked form of segment 0, the optimized form, the index
+ *             of the block's first word, the index just past its last word
+ * Returns: True if the block was changed
+ * Notes: The block must be no longer than MAX_BLOCK_LENGTH. A block that
+ *        would not take fewer dispatches to run from start to end than its
+ *        plain form is left plain
+ */
+static bool optimizeBlock(const Um_decoded *decoded, Um_decoded *optimized,
+                          uint32_t start, uint32_t end)
+{
+        irInstruction block[MAX_BLOCK_LENGTH];
+        int length = end - start;
+        assert(length > 0 && length <= MAX_BLOCK_LENGTH);
+
+        for (int i = 0; i < length; i++) {
+                const Um_decoded *word = &decoded[start + i];
+                block[i].op = baseOpcode(word->opcode);
+                block[i].a = word->a;
+                block[i].b = word->b;
+                block[i].c = word->c;
+                block[i].value = word->value;
+        }
+
+        foldConstants(block, length);
+        combineLogic(block, length);
+        removeDeadWrites(block, length);
+        moveIntoSkips(block, length);
+
+        /* Each OPT_SKIP jumps to the end of the run it starts */
+        uint32_t skipped = 0;
+        for (int i = length - 1; i >= 0; i--) {
+                Um_decoded *word = &optimized[start + i];
+                word->opcode = block[i].op;
+                word->a = block[i].a;
+                word->b = block[i].b;
+                word->c = block[i].c;
+                word->value = block[i].value;
+                if (block[i].op == OPT_SKIP) {
+                        skipped++;
+                        word->value = skipped;
+                        continue;
+                }
+                if (block[i].op == IR_NOT) {
+                        word->opcode = NAND;
+                        word->c = word->b;
+                } else if (block[i].op == LV && skipped != 0) {
+                        word->opcode = OPT_LV;
+                        word->b = skipped;
+                } else if (block[i].op == OPT_AND || block[i].op == OPT_OR ||
+                           block[i].op == OPT_MOV) {
+                        word->value = skipped;
+                }
+                skipped = 0;
+        }
+        fuseBlock(optimized, start, end, end);
+
+        if (countDispatches(optimized, start, end) >=
+            countDispatches(decoded, start, end)) {
+                restoreBlock(decoded, optimized, start, end);
+                return false;
+        }
+        return true;
+}
+
+/*
+ * Name: foldConstants
+ * Purpose: Work out every value that is known without running the block,
+ *          and simplify the instructions that use them
+ * Parameters: The block, the number of instructions in it
+ * Returns: None
+ * Notes: Nothing is known at the start of a block or after an instruction
+ *        that ends one. An arithmetic instruction with both operands known
+ *        becomes an LV. With one operand known, adding 0, multiplying or
+ *        dividing by 1 and NAND with all ones become moves or NOTs. A CMOV
+ *        whose condition is known either always moves or never does.
+ *        Division by a known 0 is left alone
+ */
+static void foldConstants(irInstruction *block, int length)
+{
+        bool known[NUM_REGS] = { false };
+        uint32_t values[NUM_REGS] = { 0 };
+
+        for (int i = 0; i < length; i++) {
+                irInstruction *in = &block[i];
+                bool knownB = known[in->b], knownC = known[in->c];
+                uint32_t b = values[in->b], c = values[in->c];
+
+                switch (in->op) {
+                case CMOV:
+                        if (!knownC) {
+                                break;
+                        }
+                        if (c == 0) {
+                                in->op = OPT_SKIP;
+                        } else if (knownB) {
+                                makeConstant(in, b);
+                        } else {
+                                makeMove(in, in->b);
+                        }
+                        break;
+                case ADD:
+                        if (knownB && knownC) {
+                                makeConstant(in, b + c);
+                        } else if (knownB && b == 0) {
+                                makeMove(in, in->c);
+                        } else if (knownC && c == 0) {
+                                makeMove(in, in->b);
+                        }
+                        break;
+                case MUL:
+                        if ((knownB && knownC) || (knownB && b == 0) ||
+                            (knownC && c == 0)) {
+                                makeConstant(in, (knownB ? b : 1) *
+                                                 (knownC ? c : 1));
+                        } else if (knownB && b == 1) {
+                                makeMove(in, in->c);
+                        } else if (knownC && c == 1) {
+                                makeMove(in, in->b);
+                        }
+                        break;
+                case DIV:
+                        if (knownB && knownC && c != 0) {
+                                makeConstant(in, b / c);
+                        } else if (knownC && c == 1) {
+                                makeMove(in, in->b);
+                        }
+                        break;
+                case NAND:
+                        if (knownB && knownC) {
+                                makeConstant(in, ~(b & c));
+                        } else if ((knownB && b == 0) || (knownC && c == 0)) {
+                                makeConstant(in, ~0u);
+                        } else if (in->b == in->c ||
+                                   (knownC && c == ~0u)) {
+                                in->op = IR_NOT;
+                        } else if (knownB && b == ~0u) {
+                                in->op = IR_NOT;
+                                in->b = in->c;
+                        }
+                        break;
+                default:
+                        break;
+                }
+
+                /* A move of a known value is a constant too */
+                if ((in->op == OPT_MOV || in->op == IR_NOT) &&
+                    known[in->b]) {
+                        uint32_t value = values[in->b];
+                        makeConstant(in, in->op == IR_NOT ? ~value : value);
+                }
+                if (in->op == OPT_MOV && in->a == in->b) {
+                        in->op = OPT_SKIP;
+                }
+
+                if (endsBlock(in->op)) {
+                        for (int reg = 0; reg < NUM_REGS; reg++) {
+                                known[reg] = false;
+                        }
+                } else if (in->op == LV) {
+                        known[in->a] = true;
+                        values[in->a] = in->value;
+                } else {
+                        unsigned writes = writesOf(in);
+                        for (int reg = 0; reg < NUM_REGS; reg++) {
+                                if (writes & REG_BIT(reg)) {
+                                        known[reg] = false;
+                                }
+                        }
+                }
+        }
+}
+
+/*
+ * Name: combineLogic
+ * Purpose: Turn the NAND sequences that make AND and OR into one instruction
+ * Parameters: The block, the number of instructions in it
+ * Returns: None
+ * Notes: NOT (x NAND y) is x AND y, and (NOT x) NAND (NOT y) is x OR y, as
+ *        long as x and y have not changed since the inner instructions ran.
+ *        A sequence is only combined if nothing else reads what the inner
+ *        instructions wrote, so that removeDeadWrites drops them, and if
+ *        other instructions come between them. Otherwise the
+ *        superinstructions for NAND pairs and triples run it as fast
+ */
+static void combineLogic(irInstruction *block, int length)
+{
+        uint8_t liveAfter[MAX_BLOCK_LENGTH];
+        findLiveness(block, length, liveAfter);
+
+        for (int i = 0; i < length; i++) {
+                irInstruction *in = &block[i];
+                if (in->op == IR_NOT) {
+                        int j = lastWriter(block, i, in->b);
+                        if (j < 0 || j == i - 1 || block[j].op != NAND ||
+                            block[j].b == block[j].a ||
+                            block[j].c == block[j].a ||
+                            !unchangedSince(block, j, i, block[j].b) ||
+                            !unchangedSince(block, j, i, block[j].c) ||
+                            !diesAt(block, liveAfter, i, in->b) ||
+                            readSince(block, j, i, in->b)) {
+                                continue;
+                        }
+                        in->op = OPT_AND;
+                        in->b = block[j].b;
+                        in->c = block[j].c;
+                } else if (in->op == NAND && in->b != in->c) {
+                        int j = lastWriter(block, i, in->b);
+                        int k = lastWriter(block, i, in->c);
+                        if (j < 0 || k < 0 || j + k == 2 * i - 3 ||
+                            block[j].op != IR_NOT ||
+                            block[k].op != IR_NOT ||
+                            block[j].b == block[j].a ||
+                            block[k].b == block[k].a ||
+                            !unchangedSince(block, j, i, block[j].b) ||
+                            !unchangedSince(block, k, i, block[k].b) ||
+                            !diesAt(block, liveAfter, i, in->b) ||
+                            !diesAt(block, liveAfter, i, in->c) ||
+                            readSince(block, j, i, in->b) ||
+                            readSince(block, k, i, in->c)) {
+                                continue;
+                        }
+                        in->op = OPT_OR;
+                        in->b = block[j].b;
+                        in->c = block[k].b;
+                }
+        }
+}
+
+/*
+ * Name: removeDeadWrites
+ * Purpose: Drop instructions whose only effect is a write nothing reads
+ * Parameters: The block, the number of instructions in it
+ * Returns: None
+ * Notes: Works back from the end of the block, where every register counts
+ *        as read. SSTORE counts as reading every register too, since a store
+ *        into the running block sends the rest of it to the plain form.
+ *        Only instructions that cannot fail are dropped, so SLOAD and DIV
+ *        always stay
+ */
+static void removeDeadWrites(irInstruction *block, int length)
+{
+        unsigned live = ALL_REGS;
+        for (int i = length - 1; i >= 0; i--) {
+                irInstruction *in = &block[i];
+                switch (in->op) {
+                case CMOV:
+                case ADD:
+                case MUL:
+                case NAND:
+                case LV:
+                case IR_NOT:
+                case OPT_AND:
+                case OPT_OR:
+                case OPT_MOV:
+                        if ((live & writesOf(in)) == 0) {
+                                in->op = OPT_SKIP;
+                                continue;
+                        }
+                        break;
+                default:
+                        break;
+                }
+                if (in->op == SSTORE || endsBlock(in->op)) {
+                        live = ALL_REGS;
+                }
+                live = (live & ~writesOf(in)) | readsOf(in);
+        }
+}
+
+/*
+ * Name: moveIntoSkips
+ * Purpose: Move register arithmetic up over the dropped instructions before it
+ * Parameters: The block, the number of instructions in it
+ * Returns: None
+ * Notes: Dropped instructions do nothing, so this changes nothing but where
+ *        the runs of them are. Instructions that touch memory or I/O, or
+ *        might fail, stay where they are, so the program counter is right
+ *        whenever anything outside the registers sees it
+ */
+static void moveIntoSkips(irInstruction *block, int length)
+{
+        int hole = -1;
+        for (int i = 0; i < length; i++) {
+                if (block[i].op == OPT_SKIP) {
+                        if (hole < 0) {
+                                hole = i;
+                        }
+                } else if (isRegisterOnly(block[i].op) && hole >= 0) {
+                        block[hole] = block[i];
+                        block[i].op = OPT_SKIP;
+                        hole++;
+                } else {
+                        hole = -1;
+                }
+        }
+}
+
+/*
+ * Name: findLiveness
+ * Purpose: Find which registers are read before they are written again
+ * Parameters: The block, the number of instructions in it, an array to set
+ *             for each instruction
+ * Returns: None
+ * Notes: liveAfter[i] has bit n set if register n may be read after
+ *        instruction i before anything writes it. Every register counts as
+ *        read at the end of the block and by SSTORE, as in removeDeadWrites
+ */
+static void findLiveness(const irInstruction *block, int length,
+                         uint8_t *liveAfter)
+{
+        unsigned live = ALL_REGS;
+        for (int i = length - 1; i >= 0; i--) {
+                liveAfter[i] = live;
+                if (block[i].op == SSTORE || endsBlock(block[i].op)) {
+                        live = ALL_REGS;
+                }
+                live = (live & ~writesOf(&block[i])) | readsOf(&block[i]);
+        }
+}
+
+/*
+ * Name: restoreBlock
+ * Purpose: Copy the plain form of a block over its optimized form
+ * Parameters: The unpacked form of segment 0, the optimized form, the index
+ *             of the block's first word, the index just past its last word
+ * Returns: None
+ * Notes: None
+ */
+static void restoreBlock(const Um_decoded *decoded, Um_decoded *optimized,
+                         uint32_t start, uint32_t end)
+{
+        for (uint32_t i = start; i < end; i++) {
+                optimized[i] = decoded[i];
+        }
+        /* The plain form may fuse a sequence across the end of the block */
+        fuseBlock(optimized, start, end, end);
+}
+
+/*
+ * Name: fuseBlock
+ * Purpose: Give instructions of a block their fused opcodes
+ * Parameters: An unpacked form of segment 0, the index of the first
+ *             instruction to fuse, the index just past the last one, the
+ *             index just past the block's last word
+ * Returns: None
+ * Notes: No sequence is fused across the end of the block, since the next
+ *        block may be put back to its plain form on its own
+ */
+static void fuseBlock(Um_decoded *program, uint32_t from, uint32_t to,
+                      uint32_t end)
+{
+        for (uint32_t i = from; i < to; i++) {
+                unsigned second = i + 1 < end
+                                  ? baseOpcode(program[i + 1].opcode)
+                                  : NO_OPCODE;
+                unsigned third = i + 2 < end
+                                 ? baseOpcode(program[i + 2].opcode)
+                                 : NO_OPCODE;
+                program[i].opcode = fuseOpcodes(baseOpcode(program[i].opcode),
+                                                second, third);
+        }
+}
+
+/*
+ * Name: countDispatches
+ * Purpose: Count the handlers a block runs, start to end
+ * Parameters: An unpacked form of segment 0, the index of the block's first
+ *             word, the index just past its last word
+ * Returns: The number of dispatches
+ * Notes: None
+ */
+static uint32_t countDispatches(const Um_decoded *program, uint32_t start,
+                                uint32_t end)
+{
+        uint32_t count = 0;
+        uint32_t i = start;
+        while (i < end) {
+                const Um_decoded *word = &program[i];
+                count++;
+                if (word->opcode == OPT_SKIP) {
+                        i += word->value;
+                } else if (word->opcode == OPT_LV) {
+                        i += 1 + word->b;
+                } else if (word->opcode == OPT_AND ||
+                           word->opcode == OPT_OR ||
+                           word->opcode == OPT_MOV) {
+                        i += 1 + word->value;
+                } else {
+                        i += fusedLength(word->opcode);
+                }
+        }
+        return count;
+}
+
+/*
+ * Name: lastWriter
+ * Purpose: Find the instruction that last wrote a register before another
+ * Parameters: The block, the index of the later instruction, the register
+ * Returns: The index of the writer, or -1 if nothing in the block wrote it
+ * Notes: None
+ */
+static int lastWriter(const irInstruction *block, int index, unsigned reg)
+{
+        for (int i = index - 1; i >= 0; i--) {
+                if (writesOf(&block[i]) & REG_BIT(reg)) {
+                        return i;
+                }
+        }
+        return -1;
+}
+
+/*
+ * Name: unchangedSince
+ * Purpose: Check that a register holds the same value at two points
+ * Parameters: The block, the index of the earlier instruction, the index of
+ *             the later one, the register
+ * Returns: True if nothing between the two instructions writes the register
+ * Notes: None
+ */
+static bool unchangedSince(const irInstruction *block, int from, int to,
+                           unsigned reg)
+{
+        for (int i = from + 1; i < to; i++) {
+                if (writesOf(&block[i]) & REG_BIT(reg)) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+/*
+ * Name: readSince
+ * Purpose: Check whether a register is read between two instructions
+ * Parameters: The block, the index of the earlier instruction, the index of
+ *             the later one, the register
+ * Returns: True if anything between the two instructions reads the register
+ * Notes: None
+ */
+static bool readSince(const irInstruction *block, int from, int to,
+                      unsigned reg)
+{
+        for (int i = from + 1; i < to; i++) {
+                if (readsOf(&block[i]) & REG_BIT(reg)) {
+                        return true;
+                }
+        }
+        return false;
+}
+
+/*
+ * Name: diesAt
+ * Purpose: Check whether an instruction is the last to read a register's
+ *          value
+ * Parameters: The block, the registers live after each instruction, the
+ *             index of the instruction, the register
+ * Returns: True if nothing after the instruction reads the value it read
+ * Notes: None
+ */
+static bool diesAt(const irInstruction *block, const uint8_t *liveAfter,
+                   int index, unsigned reg)
+{
+        return block[index].a == reg || !(liveAfter[index] & REG_BIT(reg));
+}
+
+/*
+ * Name: readsOf
+ * Purpose: Get the registers an instruction reads
+ * Parameters: The instruction
+ * Returns: A mask with bit n set if register n is read
+ * Notes: CMOV reads the register it may write, which keeps its old value
+ *        otherwise
+ */
+static unsigned readsOf(const irInstruction *instruction)
+{
+        unsigned a = REG_BIT(instruction->a);
+        unsigned b = REG_BIT(instruction->b);
+        unsigned c = REG_BIT(instruction->c);
+        switch (instruction->op) {
+        case CMOV:
+        case SSTORE:
+                return a | b | c;
+        case SLOAD:
+        case ADD:
+        case MUL:
+        case DIV:
+        case NAND:
+        case LOADP:
+        case OPT_AND:
+        case OPT_OR:
+                return b | c;
+        case ACTIVATE:
+        case INACTIVATE:
+        case OUT:
+                return c;
+        case IR_NOT:
+        case OPT_MOV:
+                return b;
+        default:
+                return 0;
+        }
+}
+
+/*
+ * Name: writesOf
+ * Purpose: Get the registers an instruction writes
+ * Parameters: The instruction
+ * Returns: A mask with bit n set if register n is written
+ * Notes: None
+ */
+static unsigned writesOf(const irInstruction *instruction)
+{
+        switch (instruction->op) {
+        case CMOV:
+        case SLOAD:
+        case ADD:
+        case MUL:
+        case DIV:
+        case NAND:
+        case LV:
+        case IR_NOT:
+        case OPT_AND:
+        case OPT_OR:
+        case OPT_MOV:
+                return REG_BIT(instruction->a);
+        case ACTIVATE:
+                return REG_BIT(instruction->b);
+        case IN:
+                return REG_BIT(instruction->c);
+        default:
+                return 0;
+        }
+}
+
+/*
+ * Name: endsBlock
+ * Purpose: Check whether an instruction ends a block
+ * Parameters: The opcode
+ * Returns: True for LOADP, HALT, IN and OUT
+ * Notes: None
+ */
+static bool endsBlock(unsigned op)
+{
+        return op == LOADP || op == HALT || op == IN || op == OUT;
+}
+
+/*
+ * Name: isRegisterOnly
+ * Purpose: Check whether an instruction only reads and writes registers
+ * Parameters: The opcode
+ * Returns: True for instructions that cannot fail and touch nothing else
+ * Notes: DIV is left out since it fails on a divisor of 0
+ */
+static bool isRegisterOnly(unsigned op)
+{
+        switch (op) {
+        case CMOV:
+        case ADD:
+        case MUL:
+        case NAND:
+        case LV:
+        case IR_NOT:
+        case OPT_AND:
+        case OPT_OR:
+        case OPT_MOV:
+                return true;
+        default:
+                return false;
+        }
+}
+
+/*
+ * Name: makeConstant
+ * Purpose: Turn an instruction into an LV of a known value
+ * Parameters: The instruction, the value its destination ends up with
+ * Returns: None
+ * Notes: None
+ */
+static inline void makeConstant(irInstruction *instruction, uint32_t value)
+{
+        instruction->op = LV;
+        instruction->b = 0;
+        instruction->c = 0;
+        instruction->value = value;
+}
+
+/*
+ * Name: makeMove
+ * Purpose: Turn an instruction into a copy of one register into another
+ * Parameters: The instruction, the register copied from
+ * Returns: None
+ * Notes: None
+ */
+static inline void makeMove(irInstruction *instruction, unsigned source)
+{
+        instruction->op = OPT_MOV;
+        instruction->b = source;
+        instruction->c = 0;
+}
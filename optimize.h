@@ -0,0 +1,29 @@
+/**************************************************************
+ *
+ *                     optimize.h
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Interface for the load-time optimizer of segment 0
+ *
+ **************************************************************/
+
+#ifndef OPTIMIZE_INCLUDED
+#define OPTIMIZE_INCLUDED
+
+#include <stdint.h>
+#include "memory.h"
+
+/* What blockFlags holds for each word of segment 0 */
+#define BLOCK_START 1
+#define BLOCK_OPTIMIZED 2
+
+void optimizeProgram(const Um_decoded *decoded, uint32_t length,
+                     Um_decoded *optimized, uint8_t *blockFlags);
+void deoptimizeBlock(const Um_decoded *decoded, uint32_t length,
+                     Um_decoded *optimized, uint8_t *blockFlags,
+                     uint32_t index);
+
+#endif
@@ -0,0 +1,245 @@
+/**************************************************************
+ *
+ *                     profile.c
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Implementation of the execution profiler, only built
+ *              with "make PROFILE=1".
+ *
+ *              Counts every instruction the interpreter retires, by
+ *              opcode and by segment 0 address, along with what
+ *              loadProgram, mapSeg and unmapSeg did. printProfile
+ *              writes the report when the program halts.
+ *
+ *              A superinstruction is counted once, under its fused
+ *              opcode and the address of its first instruction, and
+ *              retires as many instructions as it runs.
+ *
+ **************************************************************/
+
+#include "profile.h"
+#include "memory.h"
+#include "mem.h"
+
+/* Macro Definitions */
+#define TOP_PCS 20
+#define INIT_PC_COUNTS 1024
+
+static const char *const opcodeNames[NUM_DECODED_OPCODES] = {
+        "CMOV", "SLOAD", "SSTORE", "ADD", "MUL", "DIV", "NAND", "HALT",
+        "ACTIVATE", "INACTIVATE", "OUT", "IN", "LOADP", "LV", "(14)", "(15)",
+        "LV+SLOAD", "LV+SSTORE", "LV+LV", "LV+LOADP", "NAND+NAND",
+        "NAND+NAND+NAND", "LV+CMOV+LOADP", "SKIP", "LV+SKIP", "AND", "OR",
+        "MOV"
+};
+
+/*
+ * Counters for the whole run. pcCounts is indexed by segment 0 address and
+ * grows to fit the highest address executed, whichever program was loaded
+ * at the time
+ */
+static uint64_t opcodeCounts[NUM_DECODED_OPCODES];
+static uint64_t *pcCounts = NULL;
+static size_t pcCountsLength = 0;
+static uint64_t loadpJumps = 0;
+static uint64_t programLoads = 0;
+static uint64_t wordsDecoded = 0;
+static uint64_t segmentsMapped = 0;
+static uint64_t wordsMapped = 0;
+static uint64_t segmentsUnmapped = 0;
+static uint64_t bytesCopied = 0;
+
+/* Function Declarations */
+static void growPcCounts(uint32_t pc);
+
+/*
+ * Name: profileInstruction
+ * Purpose: Count an instruction about to be retired
+ * Parameters: Its address in segment 0, its opcode, which may be fused
+ * Returns: None
+ * Notes: None
+ */
+void profileInstruction(uint32_t pc, unsigned opcode)
+{
+        opcodeCounts[opcode]++;
+        if (pc >= pcCountsLength) {
+                growPcCounts(pc);
+        }
+        pcCounts[pc]++;
+}
+
+/*
+ * Name: profileLoadProgram
+ * Purpose: Count a loadProgram
+ * Parameters: True if it only jumped within segment 0, the length of the
+ *             new program otherwise
+ * Returns: None
+ * Notes: A real load shares the source segment, so its cost is decoding
+ *        the new program rather than copying it
+ */
+void profileLoadProgram(bool jump, uint32_t length)
+{
+        if (jump) {
+                loadpJumps++;
+        }
+        else {
+                programLoads++;
+                wordsDecoded += length;
+        }
+}
+
+/*
+ * Name: profileMapSeg
+ * Purpose: Count a mapped segment
+ * Parameters: Its length in words
+ * Returns: None
+ * Notes: None
+ */
+void profileMapSeg(uint32_t length)
+{
+        segmentsMapped++;
+        wordsMapped += length;
+}
+
+/*
+ * Name: profileUnmapSeg
+ * Purpose: Count an unmapped segment
+ * Parameters: None
+ * Returns: None
+ * Notes: None
+ */
+void profileUnmapSeg(void)
+{
+        segmentsUnmapped++;
+}
+
+/*
+ * Name: profileCopy
+ * Purpose: Count bytes copied because a segment shared by loadProgram was
+ *          stored to
+ * Parameters: The number of bytes copied
+ * Returns: None
+ * Notes: None
+ */
+void profileCopy(size_t nbytes)
+{
+        bytesCopied += nbytes;
+}
+
+/*
+ * Name: printProfile
+ * Purpose: Write the profile report
+ * Parameters: The stream to write to
+ * Returns: None
+ * Notes: Opcodes that never ran are skipped. Hot addresses are listed most
+ *        frequent first. Percentages are of dispatches, which is fewer than
+ *        the instructions retired when superinstructions ran
+ */
+void printProfile(FILE *out)
+{
+        uint64_t total = 0;
+        uint64_t dispatches = 0;
+        uint64_t fused = 0;
+        for (int op = 0; op < NUM_DECODED_OPCODES; op++) {
+                uint64_t retired = opcodeCounts[op] * fusedLength(op);
+                total += retired;
+                dispatches += opcodeCounts[op];
+                if (fusedLength(op) > 1) {
+                        fused += retired;
+                }
+        }
+        double scale = dispatches > 0 ? 100.0 / dispatches : 0.0;
+
+        fprintf(out, "instructions retired: %llu\n",
+                (unsigned long long) total);
+        fprintf(out, "dispatches: %llu, %llu instructions fused (%.2f%%)\n",
+                (unsigned long long) dispatches, (unsigned long long) fused,
+                total > 0 ? 100.0 * fused / total : 0.0);
+        for (int op = 0; op < NUM_DECODED_OPCODES; op++) {
+                if (opcodeCounts[op] == 0) {
+                        continue;
+                }
+                fprintf(out, "  %-14s %14llu %6.2f%%\n", opcodeNames[op],
+                        (unsigned long long) opcodeCounts[op],
+                        opcodeCounts[op] * scale);
+        }
+
+        /* Keep the TOP_PCS busiest addresses in order, busiest first */
+        uint32_t top[TOP_PCS];
+        int numTop = 0;
+        for (size_t pc = 0; pc < pcCountsLength; pc++) {
+                uint64_t count = pcCounts[pc];
+                if (count == 0 ||
+                    (numTop == TOP_PCS && count <= pcCounts[top[numTop - 1]])) {
+                        continue;
+                }
+                int slot = numTop < TOP_PCS ? numTop++ : TOP_PCS - 1;
+                while (slot > 0 && pcCounts[top[slot - 1]] < count) {
+                        top[slot] = top[slot - 1];
+                        slot--;
+                }
+                top[slot] = pc;
+        }
+        fprintf(out, "hottest segment 0 addresses:\n");
+        for (int i = 0; i < numTop; i++) {
+                fprintf(out, "  %10u %14llu %6.2f%%\n", top[i],
+                        (unsigned long long) pcCounts[top[i]],
+                        pcCounts[top[i]] * scale);
+        }
+
+        fprintf(out, "loadProgram: %llu jumps within segment 0, "
+                "%llu program loads (%llu words decoded)\n",
+                (unsigned long long) loadpJumps,
+                (unsigned long long) programLoads,
+                (unsigned long long) wordsDecoded);
+        fprintf(out, "segments: %llu mapped (%llu words), %llu unmapped, "
+                "%llu bytes copied on write\n",
+                (unsigned long long) segmentsMapped,
+                (unsigned long long) wordsMapped,
+                (unsigned long long) segmentsUnmapped,
+                (unsigned long long) bytesCopied);
+}
+
+/*
+ * Name: freeProfile
+ * Purpose: Free the address counters
+ * Parameters: None
+ * Returns: None
+ * Notes: None
+ */
+void freeProfile(void)
+{
+        if (pcCounts != NULL) {
+                FREE(pcCounts);
+        }
+        pcCountsLength = 0;
+}
+
+/*
+ * Name: growPcCounts
+ * Purpose: Make room to count an address past the end of pcCounts
+ * Parameters: The address
+ * Returns: None
+ * Notes: New counters start at 0
+ */
+static void growPcCounts(uint32_t pc)
+{
+        size_t newLength = pcCountsLength > 0 ? pcCountsLength
+                                              : INIT_PC_COUNTS;
+        while (newLength <= pc) {
+                newLength *= 2;
+        }
+        if (pcCounts == NULL) {
+                pcCounts = CALLOC(newLength, sizeof(uint64_t));
+        }
+        else {
+                RESIZE(pcCounts, newLength * sizeof(uint64_t));
+                for (size_t i = pcCountsLength; i < newLength; i++) {
+                        pcCounts[i] = 0;
+                }
+        }
+        pcCountsLength = newLength;
+}
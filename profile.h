@@ -0,0 +1,50 @@
+/**************************************************************
+ *
+ *                     profile.h
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Interface for the execution profiler. The PROFILE_
+ *              macros are what the rest of the UM calls; they
+ *              expand to nothing unless the UM is built with
+ *              -DUM_PROFILE ("make PROFILE=1")
+ *
+ **************************************************************/
+
+#ifndef PROFILE_INCLUDED
+#define PROFILE_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef UM_PROFILE
+
+void profileInstruction(uint32_t pc, unsigned opcode);
+void profileLoadProgram(bool jump, uint32_t length);
+void profileMapSeg(uint32_t length);
+void profileUnmapSeg(void);
+void profileCopy(size_t nbytes);
+void printProfile(FILE *out);
+void freeProfile(void);
+
+#define PROFILE_INSTRUCTION(pc, opcode) profileInstruction(pc, opcode)
+#define PROFILE_LOAD_PROGRAM(jump, length) profileLoadProgram(jump, length)
+#define PROFILE_MAP_SEG(length) profileMapSeg(length)
+#define PROFILE_UNMAP_SEG() profileUnmapSeg()
+#define PROFILE_COPY(nbytes) profileCopy(nbytes)
+
+#else
+
+#define PROFILE_INSTRUCTION(pc, opcode) ((void) 0)
+#define PROFILE_LOAD_PROGRAM(jump, length) ((void) 0)
+#define PROFILE_MAP_SEG(length) ((void) 0)
+#define PROFILE_UNMAP_SEG() ((void) 0)
+#define PROFILE_COPY(nbytes) ((void) 0)
+
+#endif
+
+#endif
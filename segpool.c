@@ -0,0 +1,646 @@
+/**************************************************************
+ *
+ *                     segpool.c
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Implementation of the size-class allocator that
+ *              holds UM segments.
+ *
+ *              Requests are rounded up to a power of two between
+ *              16 bytes and 1 MB. Each size class has a free list of
+ *              blocks that were given back, and new blocks are carved
+ *              out of large zeroed chunks, so a program that maps and
+ *              unmaps segments over and over stops calling malloc
+ *              once its working set is built. Larger requests are
+ *              anonymous mappings of their own, so the kernel hands
+ *              out zero pages as they are first touched and a
+ *              program that maps a big buffer and uses a little of it
+ *              only pays for that little. They are unmapped as soon
+ *              as they are given back. All chunks are freed at once
+ *              when the pool is freed.
+ *
+ *              With a recycler thread started, blocks of
+ *              RECYCLE_MIN_BYTES or more that are given back are
+ *              passed to that thread through a lock-free queue
+ *              instead of a free list. It zeroes them and hands them
+ *              back through a queue per size class, which poolAlloc
+ *              tries first, so a segment mapped after one was
+ *              unmapped usually needs no memset on the machine's
+ *              thread. Smaller blocks are cheaper to zero in place
+ *              than to pass between cores, so they keep to the free
+ *              lists.
+ *
+ *              Allocations a running program can cause report failure
+ *              through failAllocation. That raises Mem_Failed unless
+ *              the thread has asked to catch failures itself, which
+ *              libum does so a program that runs the host out of
+ *              memory only faults.
+ *
+ **************************************************************/
+
+#include <assert.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "segpool.h"
+#include "mem.h"
+#include "except.h"
+
+/* Macro Definitions */
+#define MIN_CLASS_SHIFT 4
+#define MAX_CLASS_SHIFT 20
+#define NUM_CLASSES (MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1)
+#define CHUNK_SIZE ((size_t) 1 << MAX_CLASS_SHIFT)
+#define RING_SIZE 256
+#define RECYCLE_MIN_BYTES 1024
+#define RECYCLE_MIN_CLASS 6
+#define WAKE_BATCH 32
+#define SPIN_LIMIT 4096
+#define CACHE_LINE 64
+
+/* Where failAllocation jumps on this thread, or NULL to raise Mem_Failed */
+static __thread jmp_buf *failureLanding = NULL;
+
+/* Tells the processor the recycler is busy-waiting */
+#if defined(__x86_64__) || defined(__i386__)
+#define SPIN_PAUSE() __builtin_ia32_pause()
+#else
+#define SPIN_PAUSE() ((void) 0)
+#endif
+
+/*
+ * Name: chunk
+ * Purpose: Header of a block of memory that size-class blocks are carved from
+ * Members: next - the chunk allocated before this one
+ *          data - the memory blocks are carved from
+ */
+typedef struct chunk {
+        struct chunk *next;
+        uint64_t data[];
+} *chunk;
+
+/*
+ * Name: blockRing
+ * Purpose: A lock-free queue of blocks from one thread to one other
+ * Members: head - the number of blocks ever taken out. Only the consumer
+ *                 writes it
+ *          tail - the number of blocks ever put in. Only the producer
+ *                 writes it
+ *          slots - the blocks, at their count modulo RING_SIZE
+ * Notes: head and tail are padded apart so the two threads do not fight
+ *        over one cache line
+ */
+typedef struct blockRing {
+        uint64_t head;
+        char headPadding[CACHE_LINE];
+        uint64_t tail;
+        char tailPadding[CACHE_LINE];
+        void *slots[RING_SIZE];
+} blockRing;
+
+/*
+ * Name: segRecycler
+ * Purpose: Contain the queues and thread that zero given-back blocks
+ * Members: dirty - blocks given back, waiting to be zeroed. The first word
+ *                  of each holds its size class
+ *          clean - for each size class, zeroed blocks ready to hand out
+ *          inFlight - for each size class, blocks put on dirty and not yet
+ *                     taken off clean. Kept at most RING_SIZE so the thread
+ *                     can always put a block on clean. Only the machine's
+ *                     thread uses it
+ *          thread - the thread doing the zeroing
+ *          lock, wake - what the thread sleeps on when dirty is empty
+ *          sleeping - set while the thread is asleep or about to be
+ *          wanted - set by poolAlloc when it is about to carve a block while
+ *                   blocks of that class are still waiting to be zeroed
+ *          stopping - set when the pool is being freed
+ */
+typedef struct segRecycler {
+        blockRing dirty;
+        blockRing clean[NUM_CLASSES];
+        uint32_t inFlight[NUM_CLASSES];
+        pthread_t thread;
+        pthread_mutex_t lock;
+        pthread_cond_t wake;
+        int sleeping;
+        int wanted;
+        int stopping;
+} *segRecycler;
+
+/*
+ * Name: segPool
+ * Purpose: Contain the free lists, chunks and counters of one allocator
+ * Members: freeLists - for each size class, a list of blocks that were given
+ *                      back. The first word of a free block points to the
+ *                      next one
+ *          chunks - every chunk allocated, newest first
+ *          cursor - where the next new block is carved from
+ *          limit - the end of the newest chunk
+ *          hits - for each class, allocations served from the free list
+ *          misses - for each class, allocations carved from a chunk
+ *          largeAllocs - allocations too big for any class
+ *          chunkBytes - total bytes held in chunks
+ *          recycler - the recycler thread's queues, or NULL if there is none
+ *          recycled - allocations served zeroed by the recycler
+ */
+struct segPool {
+        void *freeLists[NUM_CLASSES];
+        chunk chunks;
+        char *cursor;
+        char *limit;
+        uint64_t hits[NUM_CLASSES];
+        uint64_t misses[NUM_CLASSES];
+        uint64_t largeAllocs;
+        uint64_t chunkBytes;
+        segRecycler recycler;
+        uint64_t recycled;
+};
+
+/* Function Declarations */
+static inline int sizeClass(size_t nbytes);
+static void *carveBlock(segPool pool, size_t blockSize);
+static void *mapLarge(size_t nbytes);
+static inline bool ringPush(blockRing *ring, void *block);
+static inline void *ringPop(blockRing *ring);
+static bool recycleBlock(segPool pool, void *block, int class);
+static void wakeRecycler(segRecycler recycler);
+static void *runRecycler(void *arg);
+
+/*
+ * Name: makeSegPool
+ * Purpose: Create an empty allocator
+ * Parameters: None
+ * Returns: The allocator
+ * Notes: Freed by freeSegPool
+ */
+segPool makeSegPool(void)
+{
+        return allocOrFail(1, sizeof(struct segPool));
+}
+
+/*
+ * Name: poolStartRecycler
+ * Purpose: Start a thread that zeroes given-back blocks ahead of time
+ * Parameters: The allocator
+ * Returns: True if the thread is running
+ * Notes: Does nothing on a host with one processor online (where the
+ *        thread could only take time from the machine), or if the thread
+ *        cannot be made. The pool then works as before. The thread is
+ *        stopped by freeSegPool. The pool must still be used from one
+ *        thread only
+ */
+bool poolStartRecycler(segPool pool)
+{
+        if (pool->recycler != NULL ||
+            sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+                return pool->recycler != NULL;
+        }
+        segRecycler recycler = CALLOC(1, sizeof(struct segRecycler));
+        pthread_mutex_init(&recycler->lock, NULL);
+        pthread_cond_init(&recycler->wake, NULL);
+        if (pthread_create(&recycler->thread, NULL, runRecycler,
+                           recycler) != 0) {
+                pthread_cond_destroy(&recycler->wake);
+                pthread_mutex_destroy(&recycler->lock);
+                FREE(recycler);
+                return false;
+        }
+        pool->recycler = recycler;
+        return true;
+}
+
+/*
+ * Name: poolAlloc
+ * Purpose: Allocate a block of at least the given size
+ * Parameters: The allocator, the number of bytes needed, a place to say
+ *             whether the block is already all zeros
+ * Returns: The block
+ * Notes: Blocks from a free list still hold whatever was last stored in
+ *        them, so the caller zeroes only the bytes it will use. Blocks from
+ *        the recycler are all zeros. Large blocks
+ *        are zero but not committed until touched, so the caller must not
+ *        zero them again
+ */
+void *poolAlloc(segPool pool, size_t nbytes, bool *zeroed)
+{
+        if (poolIsLarge(nbytes)) {
+                (pool->largeAllocs)++;
+                *zeroed = true;
+                return mapLarge(nbytes);
+        }
+
+        int class = sizeClass(nbytes);
+        void *block;
+        if (pool->recycler != NULL && class >= RECYCLE_MIN_CLASS) {
+                block = ringPop(&(pool->recycler->clean)[class]);
+                if (block != NULL) {
+                        (pool->recycler->inFlight)[class]--;
+                        (pool->hits)[class]++;
+                        (pool->recycled)++;
+                        *zeroed = true;
+                        return block;
+                }
+        }
+        block = (pool->freeLists)[class];
+        if (block != NULL) {
+                (pool->freeLists)[class] = *(void **) block;
+                (pool->hits)[class]++;
+                *zeroed = false;
+                return block;
+        }
+
+        /*
+         * Blocks of this class the recycler has not got to yet could be
+         * waiting for WAKE_BATCH more, so have it zero them now for the
+         * allocations after this one
+         */
+        if (pool->recycler != NULL && class >= RECYCLE_MIN_CLASS &&
+            (pool->recycler->inFlight)[class] > 0) {
+                __atomic_store_n(&pool->recycler->wanted, 1,
+                                 __ATOMIC_SEQ_CST);
+                if (__atomic_load_n(&pool->recycler->sleeping,
+                                    __ATOMIC_SEQ_CST)) {
+                        wakeRecycler(pool->recycler);
+                }
+        }
+        (pool->misses)[class]++;
+        *zeroed = true;
+        return carveBlock(pool, (size_t) 1 << (class + MIN_CLASS_SHIFT));
+}
+
+/*
+ * Name: poolFree
+ * Purpose: Give a block back to the allocator
+ * Parameters: The allocator, the block, the size it was allocated with
+ * Returns: None
+ * Notes: Blocks in a size class go to the recycler if it has room, or else
+ *        on that class's free list; large blocks are unmapped right away,
+ *        which gives their pages back to the system
+ */
+void poolFree(segPool pool, void *block, size_t nbytes)
+{
+        if (poolIsLarge(nbytes)) {
+                munmap(block, nbytes);
+                return;
+        }
+
+        int class = sizeClass(nbytes);
+        if (pool->recycler != NULL && class >= RECYCLE_MIN_CLASS &&
+            recycleBlock(pool, block, class)) {
+                return;
+        }
+        *(void **) block = (pool->freeLists)[class];
+        (pool->freeLists)[class] = block;
+}
+
+/*
+ * Name: poolIsLarge
+ * Purpose: Say whether a request is too big for any size class
+ * Parameters: The number of bytes requested
+ * Returns: True if the block is a mapping of its own and must be freed one
+ *          at a time
+ * Notes: freeSegPool does not free large blocks
+ */
+bool poolIsLarge(size_t nbytes)
+{
+        return nbytes > CHUNK_SIZE;
+}
+
+/*
+ * Name: poolPrintStats
+ * Purpose: Print how often each size class was served from its free list
+ * Parameters: The allocator, the stream to print to
+ * Returns: None
+ * Notes: Classes that were never used are skipped
+ */
+void poolPrintStats(segPool pool, FILE *out)
+{
+        uint64_t totalHits = 0;
+        uint64_t totalMisses = 0;
+
+        fprintf(out, "segment pool:\n");
+        for (int class = 0; class < NUM_CLASSES; class++) {
+                uint64_t hits = (pool->hits)[class];
+                uint64_t misses = (pool->misses)[class];
+                if (hits + misses == 0) {
+                        continue;
+                }
+                fprintf(out, "  %8zu bytes: %12llu allocs, %6.2f%% hit\n",
+                        (size_t) 1 << (class + MIN_CLASS_SHIFT),
+                        (unsigned long long) (hits + misses),
+                        100.0 * hits / (hits + misses));
+                totalHits += hits;
+                totalMisses += misses;
+        }
+        if (totalHits + totalMisses > 0) {
+                fprintf(out, "  all classes: %12llu allocs, %6.2f%% hit\n",
+                        (unsigned long long) (totalHits + totalMisses),
+                        100.0 * totalHits / (totalHits + totalMisses));
+        }
+        if (pool->recycler != NULL) {
+                fprintf(out, "  recycled: %llu allocs served zeroed\n",
+                        (unsigned long long) pool->recycled);
+        }
+        fprintf(out, "  large allocs: %llu\n",
+                (unsigned long long) pool->largeAllocs);
+        fprintf(out, "  chunk bytes: %llu\n",
+                (unsigned long long) pool->chunkBytes);
+}
+
+/*
+ * Name: freeSegPool
+ * Purpose: Free every chunk and the allocator itself
+ * Parameters: The allocator
+ * Returns: None
+ * Notes: Every size-class block ever handed out is gone afterwards, whether
+ *        or not it was given back. Large blocks must be freed separately.
+ *        Stops the recycler thread first, leaving whatever is still in its
+ *        queues to go with the chunks
+ */
+void freeSegPool(segPool pool)
+{
+        segRecycler recycler = pool->recycler;
+        if (recycler != NULL) {
+                pthread_mutex_lock(&recycler->lock);
+                __atomic_store_n(&recycler->stopping, 1, __ATOMIC_RELEASE);
+                pthread_cond_signal(&recycler->wake);
+                pthread_mutex_unlock(&recycler->lock);
+                pthread_join(recycler->thread, NULL);
+                pthread_cond_destroy(&recycler->wake);
+                pthread_mutex_destroy(&recycler->lock);
+                FREE(recycler);
+        }
+        chunk curr = pool->chunks;
+        while (curr != NULL) {
+                chunk next = curr->next;
+                free(curr);
+                curr = next;
+        }
+        free(pool);
+}
+
+/*
+ * Name: catchAllocFailures
+ * Purpose: Choose what failAllocation does on the calling thread
+ * Parameters: A jump buffer for failAllocation to longjmp to, or NULL to go
+ *             back to raising Mem_Failed
+ * Returns: The jump buffer it replaces, so a caller that cleans up after a
+ *          failure can put it back and call failAllocation again
+ * Notes: Whatever was being changed when the allocation failed may be left
+ *        half done, so the jump's target should only free the machine
+ */
+jmp_buf *catchAllocFailures(jmp_buf *landing)
+{
+        jmp_buf *previous = failureLanding;
+        failureLanding = landing;
+        return previous;
+}
+
+/*
+ * Name: failAllocation
+ * Purpose: Report that memory a running program needs could not be had
+ * Parameters: None
+ * Returns: Does not return
+ * Notes: See catchAllocFailures
+ */
+void failAllocation(void)
+{
+        if (failureLanding != NULL) {
+                longjmp(*failureLanding, 1);
+        }
+        RAISE(Mem_Failed);
+}
+
+/*
+ * Name: allocOrFail
+ * Purpose: Allocate zeroed memory a running program needs
+ * Parameters: The number of elements, the size of each
+ * Returns: The memory, which is freed with free
+ * Notes: Calls failAllocation instead of returning NULL
+ */
+void *allocOrFail(size_t count, size_t size)
+{
+        void *block = calloc(count, size);
+        if (block == NULL) {
+                failAllocation();
+        }
+        return block;
+}
+
+/*
+ * Name: resizeOrFail
+ * Purpose: Resize memory from allocOrFail
+ * Parameters: The memory, its new size in bytes
+ * Returns: The resized memory
+ * Notes: Calls failAllocation instead of returning NULL, leaving the old
+ *        memory as it was
+ */
+void *resizeOrFail(void *block, size_t nbytes)
+{
+        void *resized = realloc(block, nbytes);
+        if (resized == NULL) {
+                failAllocation();
+        }
+        return resized;
+}
+
+/*
+ * Name: sizeClass
+ * Purpose: Find the smallest size class a request fits in
+ * Parameters: The number of bytes requested
+ * Returns: The index of the size class
+ * Notes: The request must not be large
+ */
+static inline int sizeClass(size_t nbytes)
+{
+        if (nbytes <= ((size_t) 1 << MIN_CLASS_SHIFT)) {
+                return 0;
+        }
+        int shift = 64 - __builtin_clzll((unsigned long long) nbytes - 1);
+        return shift - MIN_CLASS_SHIFT;
+}
+
+/*
+ * Name: carveBlock
+ * Purpose: Take a new block off the end of the newest chunk
+ * Parameters: The allocator, the size of the block
+ * Returns: The block, which is all zeros
+ * Notes: Starts a new chunk when the newest one is too full. Whatever was
+ *        left of the old chunk is never used
+ */
+static void *carveBlock(segPool pool, size_t blockSize)
+{
+        if ((size_t) (pool->limit - pool->cursor) < blockSize) {
+                chunk newChunk = allocOrFail(1, sizeof(struct chunk) +
+                                                CHUNK_SIZE);
+                newChunk->next = pool->chunks;
+                pool->chunks = newChunk;
+                pool->cursor = (char *) newChunk->data;
+                pool->limit = pool->cursor + CHUNK_SIZE;
+                pool->chunkBytes += CHUNK_SIZE;
+        }
+
+        void *block = pool->cursor;
+        pool->cursor += blockSize;
+        return block;
+}
+
+/*
+ * Name: mapLarge
+ * Purpose: Map a block too big for any size class
+ * Parameters: The size of the block
+ * Returns: The block, which is all zeros
+ * Notes: Calls failAllocation if the mapping cannot be made. Pages are only
+ *        committed when first touched
+ */
+static void *mapLarge(size_t nbytes)
+{
+        void *block = mmap(NULL, nbytes, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (block == MAP_FAILED) {
+                failAllocation();
+        }
+        return block;
+}
+
+/*
+ * Name: ringPush
+ * Purpose: Put a block on a queue, from the queue's one producer
+ * Parameters: The queue, the block
+ * Returns: False if the queue is full
+ * Notes: The block's contents are visible to whoever pops it
+ */
+static inline bool ringPush(blockRing *ring, void *block)
+{
+        uint64_t tail = ring->tail;
+        if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) ==
+            RING_SIZE) {
+                return false;
+        }
+        (ring->slots)[tail % RING_SIZE] = block;
+        __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+        return true;
+}
+
+/*
+ * Name: ringPop
+ * Purpose: Take the oldest block off a queue, from the queue's one consumer
+ * Parameters: The queue
+ * Returns: The block, or NULL if the queue is empty
+ * Notes: None
+ */
+static inline void *ringPop(blockRing *ring)
+{
+        uint64_t head = ring->head;
+        if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head) {
+                return NULL;
+        }
+        void *block = (ring->slots)[head % RING_SIZE];
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+        return block;
+}
+
+/*
+ * Name: recycleBlock
+ * Purpose: Pass a given-back block to the recycler thread
+ * Parameters: The allocator, the block, its size class
+ * Returns: False if the recycler has no room for it
+ * Notes: The thread is only woken once WAKE_BATCH blocks are waiting, so
+ *        the machine's thread rarely makes a system call here. Blocks
+ *        waiting for it cannot be handed out, which inFlight bounds, and
+ *        poolAlloc wakes it early when it would carve a block instead
+ */
+static bool recycleBlock(segPool pool, void *block, int class)
+{
+        segRecycler recycler = pool->recycler;
+        if ((recycler->inFlight)[class] == RING_SIZE) {
+                return false;
+        }
+        *(size_t *) block = class;
+        if (!ringPush(&recycler->dirty, block)) {
+                return false;
+        }
+        (recycler->inFlight)[class]++;
+
+        blockRing *dirty = &recycler->dirty;
+        if (dirty->tail - __atomic_load_n(&dirty->head, __ATOMIC_ACQUIRE) >=
+            WAKE_BATCH && __atomic_load_n(&recycler->sleeping,
+                                          __ATOMIC_SEQ_CST)) {
+                wakeRecycler(recycler);
+        }
+        return true;
+}
+
+/*
+ * Name: wakeRecycler
+ * Purpose: Wake the recycler thread if it is asleep
+ * Parameters: The recycler
+ * Returns: None
+ * Notes: The caller must already have made the reason to wake visible,
+ *        since the thread checks it again before sleeping on
+ */
+static void wakeRecycler(segRecycler recycler)
+{
+        pthread_mutex_lock(&recycler->lock);
+        pthread_cond_signal(&recycler->wake);
+        pthread_mutex_unlock(&recycler->lock);
+}
+
+/*
+ * Name: runRecycler
+ * Purpose: Zero given-back blocks and put them where poolAlloc finds them
+ * Parameters: The recycler
+ * Returns: NULL
+ * Notes: Spins for a while when there is nothing to do before going to
+ *        sleep. Setting sleeping before looking at the queue and wanted one
+ *        last time, while recycleBlock and poolAlloc set those before
+ *        looking at sleeping, means one of the two always sees the other
+ */
+static void *runRecycler(void *arg)
+{
+        segRecycler recycler = arg;
+        unsigned idle = 0;
+        for (;;) {
+                void *block = ringPop(&recycler->dirty);
+                if (block != NULL) {
+                        int class = *(size_t *) block;
+                        memset(block, 0,
+                               (size_t) 1 << (class + MIN_CLASS_SHIFT));
+                        bool pushed = ringPush(&(recycler->clean)[class],
+                                               block);
+                        assert(pushed);
+                        (void) pushed;
+                        idle = 0;
+                        continue;
+                }
+                if (__atomic_load_n(&recycler->stopping, __ATOMIC_ACQUIRE)) {
+                        return NULL;
+                }
+                if (idle < SPIN_LIMIT) {
+                        idle++;
+                        SPIN_PAUSE();
+                        continue;
+                }
+
+                pthread_mutex_lock(&recycler->lock);
+                __atomic_store_n(&recycler->sleeping, 1, __ATOMIC_SEQ_CST);
+                blockRing *dirty = &recycler->dirty;
+                while (__atomic_load_n(&dirty->tail, __ATOMIC_SEQ_CST) -
+                       dirty->head < WAKE_BATCH && !recycler->stopping &&
+                       !__atomic_load_n(&recycler->wanted,
+                                        __ATOMIC_SEQ_CST)) {
+                        pthread_cond_wait(&recycler->wake, &recycler->lock);
+                }
+                __atomic_store_n(&recycler->sleeping, 0, __ATOMIC_SEQ_CST);
+                __atomic_store_n(&recycler->wanted, 0, __ATOMIC_SEQ_CST);
+                pthread_mutex_unlock(&recycler->lock);
+                idle = 0;
+        }
+}
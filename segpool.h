@@ -0,0 +1,36 @@
+/**************************************************************
+ *
+ *                     segpool.h
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Interface for the size-class allocator that holds
+ *              UM segments
+ *
+ **************************************************************/
+
+#ifndef SEGPOOL_INCLUDED
+#define SEGPOOL_INCLUDED
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+typedef struct segPool *segPool;
+
+segPool makeSegPool(void);
+bool poolStartRecycler(segPool pool);
+void *poolAlloc(segPool pool, size_t nbytes, bool *zeroed);
+void poolFree(segPool pool, void *block, size_t nbytes);
+bool poolIsLarge(size_t nbytes);
+void poolPrintStats(segPool pool, FILE *out);
+void freeSegPool(segPool pool);
+jmp_buf *catchAllocFailures(jmp_buf *landing);
+void failAllocation(void);
+void *allocOrFail(size_t count, size_t size);
+void *resizeOrFail(void *block, size_t nbytes);
+
+#endif
@@ -0,0 +1,508 @@
+/**************************************************************
+ *
+ *                     sessions.c
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Implementation of the session server behind
+ *              ./um --serve.
+ *
+ *              Every connection to the socket is a session: a libum
+ *              machine running the program, with the connection as
+ *              its input and output. Each worker thread owns an epoll
+ *              instance and the sessions it accepted, and runs them
+ *              a slice of instructions at a time, round robin.
+ *
+ *              A session whose program wants input nobody has sent
+ *              yet is parked: it only waits for its connection to be
+ *              readable, and costs no time until bytes arrive. Its
+ *              output collects in a buffer and is sent after each
+ *              slice. A session with too much unsent output is not
+ *              run until the client reads some, so a slow client
+ *              cannot make the server hold unbounded output. The
+ *              client shuts down its writing side to end the input;
+ *              the connection is closed once the program halts and
+ *              its output is sent. A client that hangs up entirely
+ *              can never read more output, so its session is closed
+ *              at once.
+ *
+ **************************************************************/
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "sessions.h"
+#include "forkserver.h"
+#include "libum.h"
+#include "loader.h"
+#include "mem.h"
+
+/* Macro Definitions */
+#define SLICE_INSTRUCTIONS (1 << 18)
+#define INPUT_CHUNK 4096
+#define OUTPUT_HIGH_WATER (64 * 1024)
+#define MAX_EVENTS 64
+
+/*
+ * Name: session
+ * Purpose: One connection and the machine it talks to
+ * Members: connection - the client's socket, non-blocking
+ *          vm - the machine
+ *          status - what the machine is waiting for. UM_BUDGET_EXHAUSTED
+ *                   means it can run now
+ *          interest - the epoll events asked for on the connection
+ *          queued - true while the session is on its worker's run queue
+ *          closed - true once the connection is closed, for a session
+ *                   still on the run queue
+ *          nextRunnable - the next session on the run queue
+ *          output - bytes written by the program and not sent yet
+ *          outputStart - the index of the first byte not sent
+ *          outputEnd - one past the last byte in output
+ *          outputCapacity - the number of bytes allocated for output
+ *          input - the bytes last read from the connection, which the
+ *                  machine reads in place
+ */
+typedef struct session {
+        int connection;
+        um_vm *vm;
+        um_status status;
+        uint32_t interest;
+        bool queued;
+        bool closed;
+        struct session *nextRunnable;
+        uint8_t *output;
+        size_t outputStart;
+        size_t outputEnd;
+        size_t outputCapacity;
+        uint8_t input[INPUT_CHUNK];
+} session;
+
+/*
+ * Name: worker
+ * Purpose: One thread's share of the sessions
+ * Members: epoll - the thread's epoll instance. The listening socket is in
+ *                  every worker's, with a NULL pointer
+ *          listener - the listening socket, non-blocking
+ *          program, programLength - the program file, as um_create takes it
+ *          runHead, runTail - the sessions that can run now, oldest first
+ *          thread - the worker's thread
+ */
+typedef struct worker {
+        int epoll;
+        int listener;
+        const uint8_t *program;
+        size_t programLength;
+        session *runHead;
+        session *runTail;
+        pthread_t thread;
+} worker;
+
+/* Function Declarations */
+static void *runWorker(void *arg);
+static void acceptSession(worker *self);
+static void readInput(worker *self, session *client);
+static void runSession(worker *self, session *client);
+static void settleSession(worker *self, session *client);
+static bool sendOutput(session *client);
+static void keepOutput(void *context, const uint8_t *bytes, size_t length);
+static void closeSession(worker *self, session *client);
+static const char *faultName(um_fault fault);
+
+/*
+ * Name: serveSessions
+ * Purpose: Run a session of a program for every connection to a Unix socket
+ * Parameters: The socket's path, the program file, the number of worker
+ *             threads
+ * Returns: False if the program could not be read or the socket could not be
+ *          made. Otherwise it never returns
+ * Notes: The calling thread is one of the workers. The socket must not exist
+ *        yet
+ */
+bool serveSessions(const char *socketPath, const char *programPath,
+                   unsigned numThreads)
+{
+        const uint8_t *programBytes;
+        uint32_t numWords;
+        if (!mapProgramFile(programPath, &programBytes, &numWords)) {
+                return false;
+        }
+        int listener = listenOnSocket(socketPath);
+        if (listener < 0) {
+                unmapProgramFile(programBytes, numWords);
+                return false;
+        }
+        fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+
+        /*
+         * Every worker watches the listening socket. EPOLLEXCLUSIVE wakes one
+         * idle worker per connection instead of all of them
+         */
+        worker *workers = CALLOC(numThreads, sizeof(worker));
+        for (unsigned i = 0; i < numThreads; i++) {
+                workers[i].epoll = epoll_create1(EPOLL_CLOEXEC);
+                workers[i].listener = listener;
+                workers[i].program = programBytes;
+                workers[i].programLength = (size_t) numWords *
+                                           sizeof(uint32_t);
+                struct epoll_event event = { 0 };
+                event.events = EPOLLIN | EPOLLEXCLUSIVE;
+                event.data.ptr = NULL;
+                if (workers[i].epoll < 0 ||
+                    epoll_ctl(workers[i].epoll, EPOLL_CTL_ADD, listener,
+                              &event) != 0) {
+                        fprintf(stderr, "um: cannot watch %s: %s\n",
+                                socketPath, strerror(errno));
+                        if (workers[i].epoll >= 0) {
+                                close(workers[i].epoll);
+                        }
+                        numThreads = i;
+                        break;
+                }
+        }
+        if (numThreads == 0) {
+                FREE(workers);
+                close(listener);
+                unlink(socketPath);
+                unmapProgramFile(programBytes, numWords);
+                return false;
+        }
+
+        /* Start the other workers, then work on this thread too */
+        for (unsigned i = 1; i < numThreads; i++) {
+                if (pthread_create(&workers[i].thread, NULL, runWorker,
+                                   &workers[i]) != 0) {
+                        fprintf(stderr, "um: only started %u of %u "
+                                "workers\n", i, numThreads);
+                        break;
+                }
+        }
+        runWorker(&workers[0]);
+        return true;
+}
+
+/*
+ * Name: runWorker
+ * Purpose: Serve a worker's sessions
+ * Parameters: The worker
+ * Returns: Does not return
+ * Notes: While any session can run, epoll is only polled between slices, so
+ *        sessions doing I/O are not starved by ones computing
+ */
+static void *runWorker(void *arg)
+{
+        worker *self = arg;
+        struct epoll_event events[MAX_EVENTS];
+
+        for (;;) {
+                int timeout = self->runHead != NULL ? 0 : -1;
+                int numEvents = epoll_wait(self->epoll, events, MAX_EVENTS,
+                                           timeout);
+                for (int i = 0; i < numEvents; i++) {
+                        session *client = events[i].data.ptr;
+                        if (client == NULL) {
+                                acceptSession(self);
+                        }
+                        else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                                /* Nothing it makes could be sent now */
+                                closeSession(self, client);
+                        }
+                        else if (events[i].events & EPOLLIN) {
+                                readInput(self, client);
+                        }
+                        else {
+                                settleSession(self, client);
+                        }
+                }
+
+                /* Give every session that could run at the start a slice */
+                session *last = self->runTail;
+                while (last != NULL) {
+                        session *client = self->runHead;
+                        self->runHead = client->nextRunnable;
+                        if (self->runHead == NULL) {
+                                self->runTail = NULL;
+                        }
+                        client->queued = false;
+                        bool wasLast = client == last;
+                        if (client->closed) {
+                                FREE(client);
+                        }
+                        else {
+                                runSession(self, client);
+                        }
+                        if (wasLast) {
+                                break;
+                        }
+                }
+        }
+        return NULL;
+}
+
+/*
+ * Name: acceptSession
+ * Purpose: Start a session for a connection waiting on the listener
+ * Parameters: The worker
+ * Returns: None
+ * Notes: Takes one connection at a time, so that when several arrive at once
+ *        the listener stays readable and other workers take some. Another
+ *        worker may have taken the connection first. A connection whose
+ *        machine cannot be made, or that epoll cannot watch (with thousands
+ *        of sessions, max_user_watches or memory can run out), is closed
+ *        and logged
+ */
+static void acceptSession(worker *self)
+{
+        int connection = accept(self->listener, NULL, NULL);
+        if (connection < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK &&
+                    errno != EINTR && errno != ECONNABORTED) {
+                        fprintf(stderr, "um: accept failed: %s\n",
+                                strerror(errno));
+                }
+                return;
+        }
+
+        fcntl(connection, F_SETFL, O_NONBLOCK);
+        session *client;
+        NEW0(client);
+        client->connection = connection;
+        client->vm = um_create(self->program, self->programLength,
+                               keepOutput, client);
+        if (client->vm == NULL) {
+                fprintf(stderr, "um: no memory for a new session\n");
+                close(connection);
+                FREE(client);
+                return;
+        }
+        client->status = UM_BUDGET_EXHAUSTED;
+        struct epoll_event event = { 0 };
+        event.data.ptr = client;
+        if (epoll_ctl(self->epoll, EPOLL_CTL_ADD, connection, &event) != 0) {
+                fprintf(stderr, "um: cannot watch a new session: %s\n",
+                        strerror(errno));
+                close(connection);
+                um_destroy(client->vm);
+                FREE(client);
+                return;
+        }
+        settleSession(self, client);
+}
+
+/*
+ * Name: readInput
+ * Purpose: Give a parked session the bytes its client sent
+ * Parameters: The worker, the session
+ * Returns: None
+ * Notes: Only called while the machine waits for input, so whatever was read
+ *        before has all been used and the buffer can be refilled. A client
+ *        that shut down its writing side ends the input
+ */
+static void readInput(worker *self, session *client)
+{
+        assert(client->status == UM_NEEDS_INPUT);
+        ssize_t length = read(client->connection, client->input,
+                              INPUT_CHUNK);
+        if (length < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK ||
+                    errno == EINTR) {
+                        return;
+                }
+                closeSession(self, client);
+                return;
+        }
+
+        if (length == 0) {
+                um_end_input(client->vm);
+        }
+        else {
+                bool supplied = um_supply_input(client->vm, client->input,
+                                                length);
+                assert(supplied);
+                (void) supplied;
+        }
+        client->status = UM_BUDGET_EXHAUSTED;
+        settleSession(self, client);
+}
+
+/*
+ * Name: runSession
+ * Purpose: Run a session's machine for one slice
+ * Parameters: The worker, the session
+ * Returns: None
+ * Notes: A fault is reported on stderr and ends the session like a halt
+ */
+static void runSession(worker *self, session *client)
+{
+        client->status = um_run(client->vm, SLICE_INSTRUCTIONS);
+        if (client->status == UM_FAULT) {
+                fprintf(stderr, "um: session faulted at instruction %u: %s\n",
+                        um_program_counter(client->vm),
+                        faultName(um_last_fault(client->vm)));
+        }
+        settleSession(self, client);
+}
+
+/*
+ * Name: settleSession
+ * Purpose: Send what output the client takes and decide what the session
+ *          waits for next
+ * Parameters: The worker, the session
+ * Returns: None
+ * Notes: Queues the session if it can run, asks epoll for the events it
+ *        waits for, and closes it once the program has finished and all its
+ *        output is sent
+ */
+static void settleSession(worker *self, session *client)
+{
+        if (!sendOutput(client)) {
+                closeSession(self, client);
+                return;
+        }
+        size_t unsent = client->outputEnd - client->outputStart;
+        if ((client->status == UM_HALTED || client->status == UM_FAULT) &&
+            unsent == 0) {
+                closeSession(self, client);
+                return;
+        }
+
+        if (client->status == UM_BUDGET_EXHAUSTED && !client->queued &&
+            unsent <= OUTPUT_HIGH_WATER) {
+                client->queued = true;
+                client->nextRunnable = NULL;
+                if (self->runTail == NULL) {
+                        self->runHead = client;
+                }
+                else {
+                        self->runTail->nextRunnable = client;
+                }
+                self->runTail = client;
+        }
+
+        uint32_t interest = 0;
+        if (unsent > 0) {
+                interest |= EPOLLOUT;
+        }
+        if (client->status == UM_NEEDS_INPUT) {
+                interest |= EPOLLIN;
+        }
+        if (interest != client->interest) {
+                struct epoll_event event = { 0 };
+                event.events = interest;
+                event.data.ptr = client;
+                epoll_ctl(self->epoll, EPOLL_CTL_MOD, client->connection,
+                          &event);
+                client->interest = interest;
+        }
+}
+
+/*
+ * Name: sendOutput
+ * Purpose: Send a session's output until it is all sent or the socket is full
+ * Parameters: The session
+ * Returns: False if the client has gone away
+ * Notes: None
+ */
+static bool sendOutput(session *client)
+{
+        while (client->outputStart < client->outputEnd) {
+                ssize_t sent = send(client->connection,
+                                    client->output + client->outputStart,
+                                    client->outputEnd - client->outputStart,
+                                    MSG_NOSIGNAL);
+                if (sent < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        return errno == EAGAIN || errno == EWOULDBLOCK;
+                }
+                client->outputStart += sent;
+        }
+        client->outputStart = 0;
+        client->outputEnd = 0;
+        return true;
+}
+
+/*
+ * Name: keepOutput
+ * Purpose: Take a machine's output for sending
+ * Parameters: The session, the bytes, the number of bytes
+ * Returns: None
+ * Notes: The buffer grows as needed; bytes already sent are dropped first
+ */
+static void keepOutput(void *context, const uint8_t *bytes, size_t length)
+{
+        session *client = context;
+        if (client->outputStart > 0) {
+                memmove(client->output, client->output + client->outputStart,
+                        client->outputEnd - client->outputStart);
+                client->outputEnd -= client->outputStart;
+                client->outputStart = 0;
+        }
+        if (client->outputEnd + length > client->outputCapacity) {
+                size_t capacity = client->outputCapacity == 0
+                        ? INPUT_CHUNK : client->outputCapacity;
+                while (client->outputEnd + length > capacity) {
+                        capacity *= 2;
+                }
+                RESIZE(client->output, capacity);
+                client->outputCapacity = capacity;
+        }
+        memcpy(client->output + client->outputEnd, bytes, length);
+        client->outputEnd += length;
+}
+
+/*
+ * Name: closeSession
+ * Purpose: End a session
+ * Parameters: The worker, the session
+ * Returns: None
+ * Notes: Unsent output is dropped. A session on the run queue is freed when
+ *        the queue reaches it
+ */
+static void closeSession(worker *self, session *client)
+{
+        epoll_ctl(self->epoll, EPOLL_CTL_DEL, client->connection, NULL);
+        close(client->connection);
+        um_destroy(client->vm);
+        FREE(client->output);
+        client->closed = true;
+        if (!client->queued) {
+                FREE(client);
+        }
+}
+
+/*
+ * Name: faultName
+ * Purpose: Describe a fault for the server's log
+ * Parameters: The fault
+ * Returns: A short description
+ * Notes: None
+ */
+static const char *faultName(um_fault fault)
+{
+        switch (fault) {
+        case UM_FAULT_SEGMENT:
+                return "bad segment access";
+        case UM_FAULT_UNMAP:
+                return "bad unmap";
+        case UM_FAULT_PROGRAM_END:
+                return "ran past the end of the program";
+        case UM_FAULT_DIVIDE:
+                return "division by zero";
+        case UM_FAULT_OUTPUT:
+                return "output over 255";
+        case UM_FAULT_MEMORY:
+                return "memory limit reached";
+        default:
+                return "unknown fault";
+        }
+}
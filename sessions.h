@@ -0,0 +1,23 @@
+/**************************************************************
+ *
+ *                     sessions.h
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Interface for running many UM sessions of one
+ *              program in one process, one per connection to a
+ *              Unix socket
+ *
+ **************************************************************/
+
+#ifndef SESSIONS_INCLUDED
+#define SESSIONS_INCLUDED
+
+#include <stdbool.h>
+
+bool serveSessions(const char *socketPath, const char *programPath,
+                   unsigned numThreads);
+
+#endif
@@ -0,0 +1,21 @@
+#! /bin/bash
+
+# Purpose: Measure how long the UM takes to load each umbin image before it
+#          runs a single instruction
+
+runs=${1:-20}
+executable="./um"
+
+make -s um
+if [ -f $executable ] ; then
+        for image in umbin/*.um umbin/*.umz ; do
+                start=$(date +%s%N)
+                for ((i = 0; i < runs; i++)) ; do
+                        $executable --load-only $image
+                done
+                end=$(date +%s%N)
+                words=$(( $(stat -c %s $image) / 4 ))
+                micros=$(( (end - start) / runs / 1000 ))
+                printf "%-24s %9d words %9d us\n" $image $words $micros
+        done
+fi
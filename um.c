@@ -10,153 +10,281 @@
  *
  **************************************************************/
 
+#include <signal.h>
 #include <stdlib.h>
-#include <sys/stat.h>
+#include <string.h>
+#include <unistd.h>
 #include "memory.h"
+#include "loader.h"
 #include "arithmetic.h"
+#include "dispatch.h"
+#include "jit.h"
+#include "batch.h"
+#include "forkserver.h"
+#include "sessions.h"
+#include "profile.h"
 
-/* Typdefs and Enums */
-typedef enum Um_opcode {
-        CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV,
-        NAND, HALT, ACTIVATE, INACTIVATE, OUT, IN, LOADP, LV
-} Um_opcode;
-
-/* Macro Definitions */
-#define INSTR_WIDTH 4
-#define INSTR_LSB 28
-#define LV_REG_LSB 25
-#define REG_WIDTH 3
-#define A regsInCommand[0]
-#define B regsInCommand[1]
-#define C regsInCommand[2]
-
-/* Function Declarations */
-int getFileSize(char *filename);
-char getOpcode(Um_instruction instruction);
-void getThreeRegisters(uint32_t registers[], Um_instruction instruction);
+/*
+ * Name: writeStatsOnSignal
+ * Purpose: Ask the running machine for its memory statistics
+ * Parameters: The signal number (unused)
+ * Returns: None
+ * Notes: Installed for SIGUSR1, so "kill -USR1" asks a long session how much
+ *        memory it holds without stopping it. The machine writes them to
+ *        stderr at its next map, unmap, program load or input, so they are
+ *        never caught half updated
+ */
+static void writeStatsOnSignal(int signalNumber)
+{
+        (void) signalNumber;
+        requestMemoryStats();
+}
 
 int main(int argc, char *argv[])
 {
-        if (argc != 2) {
-                fprintf(stderr, "Usage: ./um <um-file>");
+        bool useJit = false;
+        bool loadOnly = false;
+        bool profile = false;
+        bool unbuffered = false;
+        bool checked = false;
+        bool memoryStats = false;
+        bool recycle = false;
+        bool optimize = false;
+        bool prewarm = false;
+        const char *checkpointPath = NULL;
+        const char *restorePath = NULL;
+        const char *batchPath = NULL;
+        const char *forkServerPath = NULL;
+        const char *servePath = NULL;
+        long numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+        int arg = 1;
+        for (; arg < argc; arg++) {
+                if (strcmp(argv[arg], "--jit") == 0) {
+                        useJit = true;
+                }
+                else if (strcmp(argv[arg], "--load-only") == 0) {
+                        loadOnly = true;
+                }
+                else if (strcmp(argv[arg], "--profile") == 0) {
+                        profile = true;
+                }
+                else if (strcmp(argv[arg], "--unbuffered") == 0) {
+                        unbuffered = true;
+                }
+                else if (strcmp(argv[arg], "--checked") == 0) {
+                        checked = true;
+                }
+                else if (strcmp(argv[arg], "--memory-stats") == 0) {
+                        memoryStats = true;
+                }
+                else if (strcmp(argv[arg], "--recycler") == 0) {
+                        recycle = true;
+                }
+                else if (strcmp(argv[arg], "--optimize") == 0) {
+                        optimize = true;
+                }
+                else if (strcmp(argv[arg], "--prewarm") == 0) {
+                        prewarm = true;
+                }
+                else if (strcmp(argv[arg], "--checkpoint-at-input") == 0 &&
+                         arg + 1 < argc) {
+                        arg++;
+                        checkpointPath = argv[arg];
+                }
+                else if (strcmp(argv[arg], "--restore") == 0 &&
+                         arg + 1 < argc) {
+                        arg++;
+                        restorePath = argv[arg];
+                }
+                else if (strcmp(argv[arg], "--batch") == 0 &&
+                         arg + 1 < argc) {
+                        arg++;
+                        batchPath = argv[arg];
+                }
+                else if (strcmp(argv[arg], "--fork-server") == 0 &&
+                         arg + 1 < argc) {
+                        arg++;
+                        forkServerPath = argv[arg];
+                }
+                else if (strcmp(argv[arg], "--serve") == 0 &&
+                         arg + 1 < argc) {
+                        arg++;
+                        servePath = argv[arg];
+                }
+                else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+                        arg++;
+                        numThreads = strtol(argv[arg], NULL, 10);
+                }
+                else {
+                        break;
+                }
+        }
+        bool needsFile = restorePath == NULL && batchPath == NULL;
+        bool batchConflict = batchPath != NULL &&
+                (restorePath != NULL || checkpointPath != NULL || profile ||
+                 loadOnly || memoryStats || recycle || optimize);
+        bool checkedConflict = checked &&
+                (useJit || restorePath != NULL || batchPath != NULL);
+        bool forkConflict = forkServerPath != NULL
+                ? batchPath != NULL || checkpointPath != NULL || checked ||
+                  profile || loadOnly || memoryStats || recycle
+                : prewarm;
+        bool serveConflict = servePath != NULL &&
+                (useJit || checked || loadOnly || profile || unbuffered ||
+                 memoryStats || recycle || optimize ||
+                 checkpointPath != NULL || restorePath != NULL ||
+                 batchPath != NULL || forkServerPath != NULL);
+        if (arg != argc - (needsFile ? 1 : 0) || batchConflict ||
+            checkedConflict || forkConflict || serveConflict ||
+            numThreads < 1) {
+                fprintf(stderr,
+                        "Usage: ./um [--jit | --checked] [--load-only] "
+                        "[--profile] [--unbuffered]\n"
+                        "            [--memory-stats] [--recycler] "
+                        "[--optimize] [--checkpoint-at-input FILE]\n"
+                        "            <um-file> | --restore FILE\n"
+                        "       ./um [--jit] --batch JOBS-FILE [-j N]\n"
+                        "       ./um [--jit] [--unbuffered] [--optimize] "
+                        "--fork-server SOCKET [--prewarm]\n"
+                        "            <um-file> | --restore FILE\n"
+                        "       ./um --serve SOCKET [-j N] <um-file>\n");
                 return EXIT_FAILURE;
         }
-        char *filename = argv[1];
-        FILE *commandFile = fopen(filename, "r");
-        int numInstructions = getFileSize(filename);
-        
-        /* Build and initialize program memory */
-        memoryInfo memory = makeMemoryInfo(numInstructions, commandFile);
-        assert(fclose(commandFile) == 0);
 
-        /* Set up command loop */
-        char opcode = 0;
-        uint32_t regsInCommand[3] = {0};
-        uint32_t currInstruction;
-        
-        /* Command Loop */
-        while(opcode != HALT) {
-                /* Fetch and decode instruction */
-                currInstruction = getCurrInstruction(memory);
-                opcode = getOpcode(currInstruction);
-                incrementProgramCounter(memory);
+#ifndef UM_PROFILE
+        if (profile) {
+                fprintf(stderr, "um: built without the profiler; "
+                        "rebuild with \"make PROFILE=1\"\n");
+                return EXIT_FAILURE;
+        }
+#endif
+
+        /* A batch runs every job in its own machine on a pool of threads */
+        if (batchPath != NULL) {
+                bool ok = runBatch(batchPath, numThreads, useJit);
+                return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        /*
+         * A session server runs a machine for each connection on a pool of
+         * threads, each multiplexing its sessions with epoll
+         */
+        if (servePath != NULL) {
+                serveSessions(servePath, argv[arg], numThreads);
+                return EXIT_FAILURE;
+        }
 
-                if (opcode == LV) {
-                        regsInCommand[0] = Bitpack_getu(currInstruction,
-                                                        REG_WIDTH, LV_REG_LSB);
+        /*
+         * A fork server's own machine has no input or output. What it writes
+         * is kept for the copies that run for each connection
+         */
+        umIO io = forkServerPath != NULL
+                ? makeHostIO(NULL, NULL)
+                : makeIO(STDIN_FILENO, STDOUT_FILENO);
+        setUnbufferedIO(io, unbuffered);
+
+        /*
+         * Build program memory, either from a checkpoint image or by mapping
+         * the program file in. A restored run first repeats the output that
+         * came before its checkpoint
+         */
+        memoryInfo memory;
+        if (checkpointPath != NULL || forkServerPath != NULL) {
+                recordOutput(io, true);
+        }
+        if (restorePath != NULL) {
+                const uint8_t *earlierOutput;
+                size_t outputLength;
+                memory = restoreCheckpoint(restorePath, &earlierOutput,
+                                           &outputLength);
+                if (memory == NULL) {
+                        fprintf(stderr, "um: %s is not a checkpoint image\n",
+                                restorePath);
+                        freeIO(io);
+                        return EXIT_FAILURE;
                 }
-                else {
-                        getThreeRegisters(regsInCommand, currInstruction);
+                for (size_t i = 0; i < outputLength; i++) {
+                        output(io, earlierOutput[i]);
+                }
+        }
+        else {
+                const uint8_t *programBytes;
+                uint32_t numInstructions;
+                if (!mapProgramFile(argv[arg], &programBytes,
+                                    &numInstructions)) {
+                        freeIO(io);
+                        return EXIT_FAILURE;
                 }
+                memory = makeMemoryInfo(programBytes, numInstructions);
+                unmapProgramFile(programBytes, numInstructions);
+        }
+        setCheckpointPath(memory, checkpointPath);
+        if (recycle) {
+                startRecycler(memory);
+        }
 
-                /* Execute instruction */
-                if (opcode == CMOV) {
-                        setRegisterValue(memory, A, conditionalMove(
-                                getRegisterValue(memory, A),
-                                getRegisterValue(memory, B),
-                                getRegisterValue(memory, C)));
-                } else if (opcode == SLOAD) {
-                        segLoad(regsInCommand, memory);
-                } else if (opcode == SSTORE) {
-                        segStore(regsInCommand, memory);
-                } else if (opcode == ADD) {
-                        setRegisterValue(memory, A, add(
-                                getRegisterValue(memory, B),
-                                getRegisterValue(memory, C)));
-                } else if (opcode == MUL) {
-                        setRegisterValue(memory, A, multiply(
-                                getRegisterValue(memory, B),
-                                getRegisterValue(memory, C)));
-                } else if (opcode == DIV) {
-                        setRegisterValue(memory, A, divide(
-                                getRegisterValue(memory, B),
-                                getRegisterValue(memory, C)));
-                } else if (opcode == NAND) {
-                        setRegisterValue(memory, A, nand(
-                                getRegisterValue(memory, B),
-                                getRegisterValue(memory, C)));
-                } else if (opcode == HALT) {
-                        
-                } else if (opcode == ACTIVATE) {
-                        mapSeg(regsInCommand, memory);
-                } else if (opcode == INACTIVATE) {
-                        unmapSeg(regsInCommand, memory);
-                } else if (opcode == OUT) {
-                        output(getRegisterValue(memory, C));
-                } else if (opcode == IN) {
-                        setRegisterValue(memory, C, input());
-                } else if (opcode == LOADP) {
-                        loadProgram(regsInCommand, memory);
-                } else if (opcode == LV) {
-                        setRegisterValue(memory, A, loadValue(currInstruction));
+        /*
+         * A fork server runs the program up to its first input once, if
+         * asked, and then serves copies of the machine until it is killed
+         */
+        if (forkServerPath != NULL) {
+                um_status status = prewarm ? prewarmProgram(memory, io)
+                                           : UM_NEEDS_INPUT;
+                if (optimize) {
+                        enableOptimizer(memory);
                 }
+                if (status != UM_FAULT) {
+                        serveForks(forkServerPath, memory, io,
+                                   status == UM_HALTED, useJit);
+                }
+                freeIO(io);
+                freeMemory(memory);
+                return EXIT_FAILURE;
+        }
+        if (optimize) {
+                enableOptimizer(memory);
         }
 
-        /* Free leftover memory */
-        freeMemory(memory);
+        /* Reads that SIGUSR1 interrupts carry on afterwards */
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = writeStatsOnSignal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGUSR1, &action, NULL);
 
-        return EXIT_SUCCESS;
-}
+        /*
+         * Run the program until it halts, unless only timing startup. Native
+         * code is not counted, so profiling always uses the interpreter. A
+         * checked program stops at its first bad segment access
+         */
+        bool halted = true;
+        if (!loadOnly) {
+                if (checked) {
+                        halted = runProgramChecked(memory, io);
+                }
+                else if (useJit && !profile) {
+                        runProgramJit(memory, io);
+                }
+                else {
+                        runProgram(memory, io);
+                }
+        }
+        flushOutput(io);
+        signal(SIGUSR1, SIG_IGN);
+        if (memoryStats) {
+                writeMemoryStats(memory, STDERR_FILENO);
+        }
+#ifdef UM_PROFILE
+        if (profile) {
+                printProfile(stderr);
+        }
+        freeProfile();
+#endif
 
-/*
- * Name: getFileSize
- * Purpose: Get instruction file length (in bytes)
- * Parameters: Name of file
- * Returns: Size of file
- * Notes: None
- */
-int getFileSize(char *filename)
-{
-        struct stat st;
-        stat(filename, &st);
-        return st.st_size / 4;
-}
+        /* Free leftover memory */
+        freeIO(io);
+        freeMemory(memory);
 
-/*
- * Name: getOpcode
- * Purpose: Get the opcode from the instruction
- * Parameters: The instruction to pull the instruction code from.
- * Returns: The opcode
- * Notes: None
- */
-char getOpcode(Um_instruction instruction)
-{
-        char opcode = Bitpack_getu(instruction, INSTR_WIDTH, INSTR_LSB);
-        return opcode;
+        return halted ? EXIT_SUCCESS : EXIT_FAILURE;
 }
-
-/*
- * Name: getThreeRegisters
- * Purpose: Get the 3 registers from the instruction
- * Parameters: An array to place the register numbers in
- * Returns: None
- * Notes: None
- */
-void getThreeRegisters(uint32_t registers[], Um_instruction instruction)
-{
-        char reg = 0;
-        for (int i = 2; i >= 0; i--) {
-                reg = Bitpack_getu(instruction, REG_WIDTH, 6 - 3 * i);
-                registers[i] = reg;
-        }
-}
\ No newline at end of file
@@ -0,0 +1,372 @@
+/**************************************************************
+ *
+ *                     umc.c
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Ahead-of-time translator from UM programs to
+ *              native executables. "umc prog.um -o prog" writes
+ *              segment 0 out as C, one function per basic block,
+ *              and compiles it against the UM runtime in libumrt.a.
+ *
+ *              Blocks start at word 0, at every word an LV constant
+ *              points to, which is how UM programs make jump
+ *              targets, and after every LOADP, where calls return
+ *              to. Each runs to the next LOADP or HALT, or into the
+ *              next block.
+ *              Arithmetic stays in host registers and segment
+ *              instructions call the memory functions the UM uses.
+ *              A LOADP from segment 0 goes through a table of the
+ *              blocks indexed by address.
+ *
+ *              A block is only right for as long as the words it
+ *              was made from are unchanged, so a store that changes
+ *              one throws the block away. Running a block that was
+ *              thrown away, loading another program, or jumping to a
+ *              word no block starts at hands the machine to the
+ *              interpreter, which finishes the run. Stores into data
+ *              kept in segment 0 cost nothing extra.
+ *
+ **************************************************************/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "memory.h"
+#include "loader.h"
+
+/* Macro Definitions */
+#define OPCODE_LSB 28
+#define LV_REG_LSB 25
+#define LV_VALUE_MASK 0x1ffffff
+#define REG_MASK 0x7
+#define WORDS_PER_LINE 6
+#define MAX_COMPILER_ARGS 128
+
+/*
+ * How to compile the translated C. The Makefile sets these to the compiler
+ * and flags the UM itself was built with
+ */
+#ifndef UMC_CC
+#define UMC_CC "gcc"
+#endif
+#ifndef UMC_CFLAGS
+#define UMC_CFLAGS "-O2 -std=gnu99"
+#endif
+#ifndef UMC_LIBS
+#define UMC_LIBS "libumrt.a -lbitpack -l40locality -lcii40 -lm -lpthread"
+#endif
+
+static const char *const instructionMacros[] = {
+        "UMC_CMOV", "UMC_SLOAD", "UMC_SSTORE", "UMC_ADD", "UMC_MUL",
+        "UMC_DIV", "UMC_NAND", "UMC_HALT", "UMC_ACTIVATE", "UMC_INACTIVATE",
+        "UMC_OUT", "UMC_IN", "UMC_LOADP", "UMC_LV"
+};
+
+/* Function Declarations */
+static bool writeTranslation(FILE *out, const char *source,
+                             const uint32_t *words, uint32_t numWords);
+static bool *findBlockStarts(const uint32_t *words, uint32_t numWords);
+static uint32_t writeBlock(FILE *out, const uint32_t *words,
+                           uint32_t numWords, const bool *blockStarts,
+                           uint32_t start);
+static void writeInstruction(FILE *out, uint32_t word, uint32_t pc,
+                             uint32_t block);
+static bool compileTranslation(const char *cFile, const char *executable);
+static int splitWords(char *string, char *args[], int numArgs);
+
+int main(int argc, char *argv[])
+{
+        bool onlyC = false;
+        const char *source = NULL;
+        const char *outPath = NULL;
+        for (int arg = 1; arg < argc; arg++) {
+                if (strcmp(argv[arg], "-S") == 0) {
+                        onlyC = true;
+                }
+                else if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) {
+                        arg++;
+                        outPath = argv[arg];
+                }
+                else if (source == NULL && argv[arg][0] != '-') {
+                        source = argv[arg];
+                }
+                else {
+                        source = NULL;
+                        break;
+                }
+        }
+        if (source == NULL || outPath == NULL) {
+                fprintf(stderr, "Usage: umc [-S] <um-file> -o <output>\n"
+                        "       -S writes the C translation instead of an "
+                        "executable\n");
+                return EXIT_FAILURE;
+        }
+
+        const uint8_t *programBytes;
+        uint32_t numWords;
+        if (!mapProgramFile(source, &programBytes, &numWords)) {
+                return EXIT_FAILURE;
+        }
+        if (numWords == 0) {
+                fprintf(stderr, "umc: %s is empty\n", source);
+                return EXIT_FAILURE;
+        }
+        uint32_t *words = ALLOC(numWords * sizeof(uint32_t));
+        copyBigEndianWords(words, programBytes, numWords);
+        unmapProgramFile(programBytes, numWords);
+
+        /* The C goes next to the executable and is removed once compiled */
+        size_t pathLength = strlen(outPath) + 3;
+        char *cFile = ALLOC(pathLength);
+        snprintf(cFile, pathLength, onlyC ? "%s" : "%s.c", outPath);
+
+        bool ok = false;
+        FILE *out = fopen(cFile, "w");
+        if (out == NULL) {
+                fprintf(stderr, "umc: %s: %s\n", cFile, strerror(errno));
+        }
+        else {
+                ok = writeTranslation(out, source, words, numWords);
+                ok = fclose(out) == 0 && ok;
+                if (!ok) {
+                        fprintf(stderr, "umc: could not write %s\n", cFile);
+                }
+        }
+        if (ok && !onlyC) {
+                ok = compileTranslation(cFile, outPath);
+                remove(cFile);
+        }
+
+        FREE(cFile);
+        FREE(words);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ * Name: writeTranslation
+ * Purpose: Write a program out as C
+ * Parameters: The stream to write to, the name of the program file, its
+ *             words, the number of words
+ * Returns: False if writing failed
+ * Notes: The original words are kept in the executable too, since segment 0
+ *        is still readable data and the interpreter may need them
+ */
+static bool writeTranslation(FILE *out, const char *source,
+                             const uint32_t *words, uint32_t numWords)
+{
+        fprintf(out, "/* Translated from %s by umc */\n\n", source);
+        fprintf(out, "#include \"umcrt.h\"\n\n");
+
+        fprintf(out, "static const uint32_t program[%u] = {", numWords);
+        for (uint32_t i = 0; i < numWords; i++) {
+                fprintf(out, "%s0x%08x,", i % WORDS_PER_LINE == 0
+                                          ? "\n        " : " ", words[i]);
+        }
+        fprintf(out, "\n};\n");
+
+        /* Remember which words went into a block as code */
+        bool *blockStarts = findBlockStarts(words, numWords);
+        uint32_t *blockEnds = CALLOC(numWords, sizeof(uint32_t));
+        for (uint32_t i = 0; i < numWords; i++) {
+                if (blockStarts[i]) {
+                        blockEnds[i] = writeBlock(out, words, numWords,
+                                                  blockStarts, i);
+                }
+        }
+
+        fprintf(out, "\nstatic const umcBlock blocks[%u] = {\n", numWords);
+        for (uint32_t i = 0; i < numWords; i++) {
+                if (blockStarts[i]) {
+                        fprintf(out, "        [%u] = block%u,\n", i, i);
+                }
+        }
+        fprintf(out, "};\n");
+
+        fprintf(out, "\nstatic const bool code[%u] = {\n", numWords);
+        for (uint32_t i = 0; i < numWords; i++) {
+                if (blockStarts[i]) {
+                        fprintf(out, "        [%u ... %u] = true,\n", i,
+                                blockEnds[i] - 1);
+                }
+        }
+        fprintf(out, "};\n\n");
+        FREE(blockEnds);
+        FREE(blockStarts);
+
+        fprintf(out, "int main(int argc, char *argv[])\n{\n");
+        fprintf(out, "        return umcMain(argc, argv, program, blocks, "
+                "code, %u);\n}\n", numWords);
+        return !ferror(out);
+}
+
+/*
+ * Name: findBlockStarts
+ * Purpose: Find the words basic blocks start at
+ * Parameters: The words of the program, the number of words
+ * Returns: An array with true for each word a block starts at, which the
+ *          caller frees
+ * Notes: Word 0, every word an LV constant points to and every word after a
+ *        LOADP. Constants that are not addresses only cost an extra block
+ *        boundary
+ */
+static bool *findBlockStarts(const uint32_t *words, uint32_t numWords)
+{
+        bool *blockStarts = CALLOC(numWords, sizeof(bool));
+        blockStarts[0] = true;
+        for (uint32_t i = 0; i < numWords; i++) {
+                unsigned opcode = words[i] >> OPCODE_LSB;
+                uint32_t value = words[i] & LV_VALUE_MASK;
+                if (opcode == LV && value < numWords) {
+                        blockStarts[value] = true;
+                }
+                else if (opcode == LOADP && i + 1 < numWords) {
+                        blockStarts[i + 1] = true;
+                }
+        }
+        return blockStarts;
+}
+
+/*
+ * Name: writeBlock
+ * Purpose: Write the function for one basic block
+ * Parameters: The stream to write to, the words of the program, the number
+ *             of words, which words start blocks, the word this block starts
+ *             at
+ * Returns: The index just past the block's last word
+ * Notes: The block ends after a LOADP or HALT, or carries on into the next
+ *        block. Running off the end of the program is left to the
+ *        interpreter
+ */
+static uint32_t writeBlock(FILE *out, const uint32_t *words,
+                           uint32_t numWords, const bool *blockStarts,
+                           uint32_t start)
+{
+        fprintf(out, "\nstatic uint64_t block%u(memoryInfo memory, "
+                "umIO io)\n{\n", start);
+        fprintf(out, "        UMC_ENTER();\n");
+
+        uint32_t pc = start;
+        for (;;) {
+                unsigned opcode = words[pc] >> OPCODE_LSB;
+                writeInstruction(out, words[pc], pc, start);
+                pc++;
+                if (opcode == LOADP || opcode == HALT) {
+                        break;
+                }
+                if (pc == numWords || blockStarts[pc]) {
+                        fprintf(out, "        UMC_NEXT(%u);\n", pc);
+                        break;
+                }
+        }
+        fprintf(out, "}\n");
+        return pc;
+}
+
+/*
+ * Name: writeInstruction
+ * Purpose: Write the C for one word of segment 0
+ * Parameters: The stream to write to, the word, its index, the index the
+ *             block it is in starts at
+ * Returns: None
+ * Notes: Opcodes 14 and 15 do nothing, matching the interpreter
+ */
+static void writeInstruction(FILE *out, uint32_t word, uint32_t pc,
+                             uint32_t block)
+{
+        unsigned opcode = word >> OPCODE_LSB;
+        unsigned a = (word >> 6) & REG_MASK;
+        unsigned b = (word >> 3) & REG_MASK;
+        unsigned c = word & REG_MASK;
+
+        fprintf(out, "        /* %u */\n", pc);
+        if (opcode == LV) {
+                fprintf(out, "        UMC_LV(%u, %uu);\n",
+                        (word >> LV_REG_LSB) & REG_MASK,
+                        word & LV_VALUE_MASK);
+        }
+        else if (opcode == HALT) {
+                fprintf(out, "        UMC_HALT();\n");
+        }
+        else if (opcode == OUT || opcode == IN) {
+                fprintf(out, "        %s(%u);\n", instructionMacros[opcode],
+                        c);
+        }
+        else if (opcode == SSTORE) {
+                fprintf(out, "        UMC_SSTORE(%u, %u, %u, %u, %u);\n",
+                        a, b, c, block, pc + 1);
+        }
+        else if (opcode <= LV) {
+                fprintf(out, "        %s(%u, %u, %u);\n",
+                        instructionMacros[opcode], a, b, c);
+        }
+}
+
+/*
+ * Name: compileTranslation
+ * Purpose: Compile the C translation into an executable
+ * Parameters: The C file, the executable to write
+ * Returns: True if the compiler succeeded
+ * Notes: Runs UMC_CC with UMC_CFLAGS and links with UMC_LIBS. The compiler's
+ *        own messages go to stderr
+ */
+static bool compileTranslation(const char *cFile, const char *executable)
+{
+        char cflags[] = UMC_CFLAGS;
+        char libs[] = UMC_LIBS;
+        char *args[MAX_COMPILER_ARGS];
+        int numArgs = 0;
+
+        args[numArgs++] = UMC_CC;
+        numArgs = splitWords(cflags, args, numArgs);
+        args[numArgs++] = "-o";
+        args[numArgs++] = (char *) executable;
+        args[numArgs++] = (char *) cFile;
+        numArgs = splitWords(libs, args, numArgs);
+        args[numArgs] = NULL;
+
+        pid_t pid = fork();
+        if (pid < 0) {
+                fprintf(stderr, "umc: fork: %s\n", strerror(errno));
+                return false;
+        }
+        if (pid == 0) {
+                execvp(args[0], args);
+                fprintf(stderr, "umc: %s: %s\n", args[0], strerror(errno));
+                _exit(127);
+        }
+
+        int status;
+        while (waitpid(pid, &status, 0) < 0) {
+                if (errno != EINTR) {
+                        fprintf(stderr, "umc: waitpid: %s\n",
+                                strerror(errno));
+                        return false;
+                }
+        }
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/*
+ * Name: splitWords
+ * Purpose: Append the space-separated words of a string to an argument list
+ * Parameters: The string, which is split in place, the argument list, the
+ *             number of arguments already in it
+ * Returns: The new number of arguments
+ * Notes: The list always keeps room for the arguments compileTranslation
+ *        adds after the words
+ */
+static int splitWords(char *string, char *args[], int numArgs)
+{
+        char *saved;
+        for (char *word = strtok_r(string, " ", &saved); word != NULL;
+             word = strtok_r(NULL, " ", &saved)) {
+                assert(numArgs < MAX_COMPILER_ARGS - 8);
+                args[numArgs++] = word;
+        }
+        return numArgs;
+}
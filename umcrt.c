@@ -0,0 +1,143 @@
+/**************************************************************
+ *
+ *                     umcrt.c
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Implementation of the runtime for programs
+ *              translated by umc.
+ *
+ *              The translated program gets the same machine the UM
+ *              would build from the original file. umcMain runs
+ *              one block after another, looking each jump target up
+ *              in the block table. A store that changes a word of a
+ *              block takes that block out of the table. When a block
+ *              hands the machine over, because it changed itself or
+ *              loaded another program, or a jump lands on a word no
+ *              block starts at, the interpreter finishes the run.
+ *
+ **************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "umcrt.h"
+#include "dispatch.h"
+
+/*
+ * The original program, which of its words were translated as code, the
+ * block each of those words is in, and the blocks that are still right
+ */
+static const uint32_t *programWords = NULL;
+static const bool *programCode = NULL;
+static uint32_t *blockOwners = NULL;
+static umcBlock *liveBlocks = NULL;
+
+/* Function Declarations */
+static bool runBlocks(memoryInfo memory, umIO io, uint32_t numWords);
+
+/*
+ * Name: umcMain
+ * Purpose: Run a translated program as a whole process
+ * Parameters: The process's arguments, the words of the original program,
+ *             the block starting at each word (NULL where none does), which
+ *             words are in a block, the number of words
+ * Returns: The process's exit status
+ * Notes: The only argument accepted is --unbuffered, which means the same
+ *        as it does for the UM
+ */
+int umcMain(int argc, char *argv[], const uint32_t *words,
+            const umcBlock *blocks, const bool *code, uint32_t numWords)
+{
+        bool unbuffered = argc == 2 && strcmp(argv[1], "--unbuffered") == 0;
+        if (argc > 2 || (argc == 2 && !unbuffered)) {
+                fprintf(stderr, "Usage: %s [--unbuffered]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+        assert(numWords > 0);
+        programWords = words;
+        programCode = code;
+        blockOwners = ALLOC(numWords * sizeof(uint32_t));
+        liveBlocks = ALLOC(numWords * sizeof(umcBlock));
+        uint32_t owner = 0;
+        for (uint32_t i = 0; i < numWords; i++) {
+                if (blocks[i] != NULL) {
+                        owner = i;
+                }
+                blockOwners[i] = owner;
+                liveBlocks[i] = blocks[i];
+        }
+
+        /* makeMemoryInfo takes the words as they are laid out in the file */
+        uint8_t *programBytes = ALLOC(numWords * sizeof(uint32_t));
+        for (uint32_t i = 0; i < numWords; i++) {
+                programBytes[4 * i] = words[i] >> 24;
+                programBytes[4 * i + 1] = words[i] >> 16;
+                programBytes[4 * i + 2] = words[i] >> 8;
+                programBytes[4 * i + 3] = words[i];
+        }
+        memoryInfo memory = makeMemoryInfo(programBytes, numWords);
+        FREE(programBytes);
+
+        umIO io = makeIO(STDIN_FILENO, STDOUT_FILENO);
+        setUnbufferedIO(io, unbuffered);
+        if (!runBlocks(memory, io, numWords)) {
+                runProgram(memory, io);
+        }
+        flushOutput(io);
+
+        FREE(liveBlocks);
+        FREE(blockOwners);
+        freeIO(io);
+        freeMemory(memory);
+        return EXIT_SUCCESS;
+}
+
+/*
+ * Name: umcStoreChangesBlock
+ * Purpose: Throw away the block a store into segment 0 changed, if any
+ * Parameters: The index stored to, the value stored, the block that is
+ *             running
+ * Returns: True if the running block was changed
+ * Notes: Only stores that give a translated word a value other than its
+ *        original one change anything. Words kept as data cost nothing.
+ *        The index must be within segment 0
+ */
+bool umcStoreChangesBlock(uint32_t index, uint32_t value, uint32_t block)
+{
+        if (!programCode[index] || programWords[index] == value) {
+                return false;
+        }
+        liveBlocks[blockOwners[index]] = NULL;
+        return blockOwners[index] == block;
+}
+
+/*
+ * Name: runBlocks
+ * Purpose: Run translated blocks from the start of segment 0
+ * Parameters: The struct containing the memory structures and variables, the
+ *             machine's I/O object, the number of words in the translated
+ *             program
+ * Returns: True if the program halted, false if the interpreter has to
+ *          finish it
+ * Notes: None
+ */
+static bool runBlocks(memoryInfo memory, umIO io, uint32_t numWords)
+{
+        uint64_t pc = 0;
+        for (;;) {
+                if (pc == UMC_HALTED) {
+                        return true;
+                }
+                if (pc == UMC_HANDED_OFF) {
+                        return false;
+                }
+                if (pc >= numWords || liveBlocks[pc] == NULL) {
+                        setProgramCounter(memory, pc);
+                        return false;
+                }
+                pc = liveBlocks[pc](memory, io);
+        }
+}
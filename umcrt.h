@@ -0,0 +1,150 @@
+/**************************************************************
+ *
+ *                     umcrt.h
+ *
+ *     Assignment: UM
+ *     Authors: Adam Weiss and Auriel Wish
+ *     Date: 4/5/2023
+ *
+ *     Purpose: Interface for the runtime that programs translated
+ *              by umc are linked against. The UMC_ macros are what
+ *              the translated C is written in; each one is a single
+ *              UM instruction.
+ *
+ **************************************************************/
+
+#ifndef UMCRT_INCLUDED
+#define UMCRT_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "memory.h"
+#include "arithmetic.h"
+
+/*
+ * A translated basic block. Runs from its first instruction to the next
+ * LOADP or HALT and returns the program counter to carry on at, or one of
+ * the statuses below. Handing off stores the registers and program counter
+ * in memory for the interpreter
+ */
+typedef uint64_t (*umcBlock)(memoryInfo memory, umIO io);
+#define UMC_HALTED ((uint64_t) 1 << 32)
+#define UMC_HANDED_OFF (UMC_HALTED + 1)
+
+int umcMain(int argc, char *argv[], const uint32_t *words,
+            const umcBlock *blocks, const bool *code, uint32_t numWords);
+bool umcStoreChangesBlock(uint32_t index, uint32_t value, uint32_t block);
+
+/*
+ * Inside a block the UM registers are the local array r, which the compiler
+ * keeps in host registers. file is the machine's own register file, which
+ * the memory functions read and write, so registers are copied to it before
+ * those calls and back afterwards, and when the block ends
+ */
+#define UMC_ENTER()                                                     \
+        uint32_t *const file = getRegisterFile(memory);                \
+        uint32_t r[8];                                                  \
+        uint32_t cmd[3];                                                \
+        UMC_RELOAD_ALL()
+#define UMC_SPILL_ALL()                                                 \
+        do {                                                            \
+                file[0] = r[0]; file[1] = r[1];                         \
+                file[2] = r[2]; file[3] = r[3];                         \
+                file[4] = r[4]; file[5] = r[5];                         \
+                file[6] = r[6]; file[7] = r[7];                         \
+        } while (0)
+#define UMC_RELOAD_ALL()                                                \
+        do {                                                            \
+                r[0] = file[0]; r[1] = file[1];                         \
+                r[2] = file[2]; r[3] = file[3];                         \
+                r[4] = file[4]; r[5] = file[5];                         \
+                r[6] = file[6]; r[7] = file[7];                         \
+        } while (0)
+#define UMC_CALL(function, a, b, c)                                     \
+        do {                                                            \
+                cmd[0] = a;                                             \
+                cmd[1] = b;                                             \
+                cmd[2] = c;                                             \
+                function(cmd, memory);                                  \
+        } while (0)
+
+/* End the block and carry on at pc, which may start another block */
+#define UMC_NEXT(pc)                                                    \
+        do {                                                            \
+                UMC_SPILL_ALL();                                        \
+                return (pc);                                            \
+        } while (0)
+
+/* Give the machine to the interpreter, which carries on at pc */
+#define UMC_HANDOFF(pc)                                                 \
+        do {                                                            \
+                UMC_SPILL_ALL();                                        \
+                setProgramCounter(memory, pc);                          \
+                return UMC_HANDED_OFF;                                  \
+        } while (0)
+
+#define UMC_CMOV(a, b, c)                                               \
+        do {                                                            \
+                if (r[c] != 0) {                                        \
+                        r[a] = r[b];                                    \
+                }                                                       \
+        } while (0)
+#define UMC_SLOAD(a, b, c)                                              \
+        do {                                                            \
+                file[b] = r[b];                                         \
+                file[c] = r[c];                                         \
+                UMC_CALL(segLoad, a, b, c);                             \
+                r[a] = file[a];                                         \
+        } while (0)
+
+/*
+ * A store into segment 0 that changes translated code throws that code
+ * away. If it was the running block, the rest of the block may be wrong
+ */
+#define UMC_SSTORE(a, b, c, block, next)                                \
+        do {                                                            \
+                file[a] = r[a];                                         \
+                file[b] = r[b];                                         \
+                file[c] = r[c];                                         \
+                UMC_CALL(segStore, a, b, c);                            \
+                if (r[a] == 0 &&                                        \
+                    umcStoreChangesBlock(r[b], r[c], block)) {          \
+                        UMC_HANDOFF(next);                              \
+                }                                                       \
+        } while (0)
+#define UMC_ADD(a, b, c) (r[a] = r[b] + r[c])
+#define UMC_MUL(a, b, c) (r[a] = r[b] * r[c])
+#define UMC_DIV(a, b, c) (r[a] = r[b] / r[c])
+#define UMC_NAND(a, b, c) (r[a] = ~(r[b] & r[c]))
+#define UMC_HALT() return UMC_HALTED
+#define UMC_ACTIVATE(a, b, c)                                           \
+        do {                                                            \
+                file[c] = r[c];                                         \
+                UMC_CALL(mapSeg, a, b, c);                              \
+                r[b] = file[b];                                         \
+        } while (0)
+#define UMC_INACTIVATE(a, b, c)                                         \
+        do {                                                            \
+                file[c] = r[c];                                         \
+                UMC_CALL(unmapSeg, a, b, c);                            \
+        } while (0)
+#define UMC_OUT(c) output(io, r[c])
+#define UMC_IN(c) (r[c] = input(io))
+
+/*
+ * A jump within segment 0 goes back to umcMain, which looks the target up in
+ * the block table. Loading any other segment replaces the program that was
+ * translated
+ */
+#define UMC_LOADP(a, b, c)                                              \
+        do {                                                            \
+                if (r[b] == 0) {                                        \
+                        UMC_NEXT(r[c]);                                 \
+                }                                                       \
+                UMC_SPILL_ALL();                                        \
+                UMC_CALL(loadProgram, a, b, c);                         \
+                return UMC_HANDED_OFF;                                  \
+        } while (0)
+#define UMC_LV(a, value) (r[a] = (value))
+
+#endif
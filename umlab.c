@@ -518,4 +518,430 @@ void loadp_seg0_test(Seq_T stream)
         append(stream, lv(r7, 65));
         append(stream, output(r7));
         append(stream, halt());
-}
\ No newline at end of file
+}
+
+/* Stress programs for benchmarking */
+
+/*
+ * Sizes of the stress programs, set from the writetests command line.
+ * Every stress program runs a loop whose trip count makes it retire about
+ * stress_instructions instructions in all
+ */
+uint32_t stress_instructions = 10000000;
+uint32_t stress_segment_words = 1 << 20;
+uint32_t stress_program_words = 256;
+
+#define STRESS_MAP_MASK 4095
+#define STRESS_JUMP_TABLE 256
+#define LOOP_TAIL_LENGTH 4
+
+/*
+ * Registers every stress loop relies on: r0 is always 0, r7 is all 1s
+ * (adding it subtracts 1), r6 counts down the iterations left, r5 holds
+ * the top of the loop and r4 is free in the loop body
+ */
+
+static inline void patch(Seq_T stream, int index, Um_instruction inst)
+{
+        Seq_put(stream, index, (void *)(uintptr_t)inst);
+}
+
+/* Put any 32-bit value in a register, using scratch if it needs two parts */
+static void load_constant(Seq_T stream, Um_register reg, uint32_t value,
+                          Um_register scratch)
+{
+        if (value < (1u << 25)) {
+                append(stream, lv(reg, value));
+                return;
+        }
+        append(stream, lv(reg, value >> 16));
+        append(stream, lv(scratch, 1 << 16));
+        append(stream, mul(reg, reg, scratch));
+        append(stream, lv(scratch, value & 0xffff));
+        append(stream, add(reg, reg, scratch));
+}
+
+/* Set up r0 and r7 */
+static void stress_prologue(Seq_T stream)
+{
+        append(stream, lv(r0, 0));
+        append(stream, lv(r7, 0));
+        append(stream, nand(r7, r7, r7));
+}
+
+/* Print "ok" and halt */
+static void stress_epilogue(Seq_T stream)
+{
+        append(stream, lv(r1, 'o'));
+        append(stream, output(r1));
+        append(stream, lv(r1, 'k'));
+        append(stream, output(r1));
+        append(stream, lv(r1, '\n'));
+        append(stream, output(r1));
+        append(stream, halt());
+}
+
+/* Trip count for a loop whose body is body_length instructions */
+static uint32_t stress_iterations(uint32_t body_length)
+{
+        uint32_t iterations = stress_instructions /
+                              (body_length + LOOP_TAIL_LENGTH);
+        return iterations > 0 ? iterations : 1;
+}
+
+/* Start a loop that runs its body the given number of times */
+static void begin_loop(Seq_T stream, uint32_t iterations)
+{
+        load_constant(stream, r6, iterations, r4);
+        append(stream, lv(r5, Seq_length(stream) + 1));
+}
+
+/* Count down r6 and go back to the top of the loop until it reaches 0 */
+static void end_loop(Seq_T stream, Um_register program)
+{
+        append(stream, add(r6, r6, r7));
+        append(stream, lv(r4, Seq_length(stream) + LOOP_TAIL_LENGTH - 1));
+        append(stream, cmov(r4, r5, r6));
+        append(stream, loadp(program, r4));
+}
+
+/* Input: None */
+/* Output: ok */
+/* Straight-line ADD, MUL, NAND, DIV and CMOV */
+void stress_arith(Seq_T stream)
+{
+        stress_prologue(stream);
+        append(stream, lv(r1, 12345));
+        append(stream, lv(r2, 67890));
+        append(stream, lv(r3, 3));
+        begin_loop(stream, stress_iterations(8));
+        append(stream, add(r1, r1, r2));
+        append(stream, mul(r2, r2, r3));
+        append(stream, nand(r3, r1, r2));
+        append(stream, add(r2, r2, r3));
+        append(stream, div(r4, r1, r7));
+        append(stream, cmov(r1, r3, r4));
+        append(stream, nand(r4, r2, r2));
+        append(stream, add(r3, r3, r4));
+        end_loop(stream, r0);
+        stress_epilogue(stream);
+}
+
+/* Input: None */
+/* Output: ok */
+/* Two segments mapped and unmapped per iteration, 0 to 4095 words long */
+void stress_map(Seq_T stream)
+{
+        stress_prologue(stream);
+        append(stream, lv(r3, STRESS_MAP_MASK));
+        begin_loop(stream, stress_iterations(6));
+        append(stream, nand(r1, r6, r3));
+        append(stream, nand(r1, r1, r1));
+        append(stream, activate(r2, r1));
+        append(stream, activate(r1, r3));
+        append(stream, inactivate(r2));
+        append(stream, inactivate(r1));
+        end_loop(stream, r0);
+        stress_epilogue(stream);
+}
+
+/* Input: None */
+/* Output: ok */
+/* Read, update and write back every word of one large segment in turn */
+void stress_stream(Seq_T stream)
+{
+        uint32_t words = 1;
+        while (words < stress_segment_words && words < (1u << 31)) {
+                words *= 2;
+        }
+
+        stress_prologue(stream);
+        load_constant(stream, r3, words, r4);
+        append(stream, activate(r1, r3));
+        append(stream, add(r3, r3, r7));
+        begin_loop(stream, stress_iterations(5));
+        append(stream, nand(r2, r6, r3));
+        append(stream, nand(r2, r2, r2));
+        append(stream, sload(r4, r1, r2));
+        append(stream, add(r4, r4, r6));
+        append(stream, sstore(r1, r2, r4));
+        end_loop(stream, r0);
+        stress_epilogue(stream);
+}
+
+/*
+ * Input: None
+ * Output: ok
+ * Every iteration jumps through a table of addresses kept in segment 0 to
+ * one of 256 small blocks, which jumps back, so three of every thirteen
+ * instructions are LOADPs
+ */
+void stress_jump(Seq_T stream)
+{
+        stress_prologue(stream);
+        append(stream, lv(r3, STRESS_JUMP_TABLE - 1));
+        begin_loop(stream, stress_iterations(9));
+        append(stream, nand(r2, r6, r3));
+        append(stream, nand(r2, r2, r2));
+        int table_base = Seq_length(stream);
+        append(stream, lv(r1, 0));
+        append(stream, add(r1, r1, r2));
+        append(stream, sload(r1, r0, r1));
+        append(stream, loadp(r0, r1));
+        uint32_t back = Seq_length(stream);
+        end_loop(stream, r0);
+        stress_epilogue(stream);
+
+        /* Each block does one addition and jumps back to the loop */
+        uint32_t blocks = Seq_length(stream);
+        for (int i = 0; i < STRESS_JUMP_TABLE; i++) {
+                append(stream, add(r2, r2, r6));
+                append(stream, lv(r1, back));
+                append(stream, loadp(r0, r1));
+        }
+        patch(stream, table_base, lv(r1, Seq_length(stream)));
+        for (int i = 0; i < STRESS_JUMP_TABLE; i++) {
+                append(stream, blocks + 3 * i);
+        }
+}
+
+/*
+ * Input: None
+ * Output: ok
+ * Copies the whole program into two segments, then loads them as the
+ * program in turn, twice per iteration. The program is padded out to
+ * stress_program_words so every load has that many words to take in
+ */
+void stress_loadprogram(Seq_T stream)
+{
+        stress_prologue(stream);
+        int length_index = Seq_length(stream);
+        append(stream, lv(r3, 0));
+        append(stream, activate(r1, r3));
+        append(stream, activate(r2, r3));
+
+        /* Copy segment 0 into both segments, last word first */
+        append(stream, add(r6, r3, r0));
+        append(stream, lv(r5, Seq_length(stream) + 1));
+        append(stream, add(r3, r6, r7));
+        append(stream, sload(r4, r0, r3));
+        append(stream, sstore(r1, r3, r4));
+        append(stream, sstore(r2, r3, r4));
+        end_loop(stream, r0);
+
+        /* Load one copy, then the other, which goes back to the top */
+        begin_loop(stream, stress_iterations(2));
+        append(stream, lv(r4, Seq_length(stream) + 2));
+        append(stream, loadp(r1, r4));
+        end_loop(stream, r2);
+        stress_epilogue(stream);
+
+        while ((uint32_t)Seq_length(stream) < stress_program_words) {
+                append(stream, 0);
+        }
+        patch(stream, length_index, lv(r3, Seq_length(stream)));
+}
+
+/*
+ * Choices for stress_random, seeded from the writetests command line. The
+ * same seed always gives the same program
+ */
+uint32_t stress_seed = 1;
+static uint32_t random_state;
+
+#define RANDOM_BODY_GROUPS 40
+#define RANDOM_SCRATCH_WORDS 16
+#define RANDOM_MAX_LVS 64
+
+/* The next number from a xorshift generator, below limit */
+static uint32_t random_below(uint32_t limit)
+{
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        return random_state % limit;
+}
+
+/* One of the registers stress_random keeps its values in, r1 to r3 */
+static Um_register random_data(void)
+{
+        return (Um_register)(r1 + random_below(3));
+}
+
+/* Print the low byte of a register, using r4 and r5 */
+static void output_byte(Seq_T stream, Um_register reg)
+{
+        append(stream, lv(r5, 255));
+        append(stream, nand(r4, reg, r5));
+        append(stream, nand(r4, r4, r4));
+        append(stream, output(r4));
+}
+
+/* Print all four bytes of a register, low byte first, and clear it */
+static void output_word(Seq_T stream, Um_register reg)
+{
+        for (int i = 0; i < 4; i++) {
+                output_byte(stream, reg);
+                append(stream, lv(r5, 256));
+                append(stream, div(reg, reg, r5));
+        }
+}
+
+/*
+ * Put the ID of the scratch segment in r4. Every register is in use, so it
+ * is kept in word 0 of segment 0, which has run by then and never runs again
+ */
+static void load_scratch_id(Seq_T stream)
+{
+        append(stream, sload(r4, r0, r0));
+}
+
+/*
+ * Append one random group of instructions to the body of stress_random.
+ * lvs holds the index of every LV of a data register so far, which a store
+ * into segment 0 may later replace with a different one
+ */
+static void random_group(Seq_T stream, int lvs[], int *num_lvs)
+{
+        Um_register a = random_data();
+        Um_register b = random_data();
+        Um_register c = random_data();
+        Um_opcode arith[] = { CMOV, ADD, MUL, NAND };
+
+        switch (random_below(9)) {
+        case 0:
+        case 1:
+                append(stream, three_register(arith[random_below(4)],
+                                              a, b, c));
+                break;
+        case 2:
+                if (*num_lvs < RANDOM_MAX_LVS) {
+                        lvs[(*num_lvs)++] = Seq_length(stream);
+                }
+                append(stream, lv(a, random_below(1 << 25)));
+                append(stream, add(a, a, r6));
+                break;
+        case 3:
+                append(stream, lv(r5, 1 + random_below(1000)));
+                append(stream, div(a, b, r5));
+                break;
+        case 4:
+                load_scratch_id(stream);
+                append(stream, lv(r5, random_below(RANDOM_SCRATCH_WORDS)));
+                if (random_below(2) == 0) {
+                        append(stream, sstore(r4, r5, a));
+                } else {
+                        append(stream, sload(a, r4, r5));
+                }
+                break;
+        case 5:
+                output_byte(stream, a);
+                break;
+        case 6:
+                /* Map a segment and throw it away again */
+                append(stream, lv(r5, random_below(64)));
+                append(stream, activate(r4, r5));
+                append(stream, inactivate(r4));
+                break;
+        case 7: {
+                /* Replace an earlier LV with one that loads something else */
+                if (*num_lvs == 0) {
+                        append(stream, nand(a, b, c));
+                        break;
+                }
+                int target = lvs[random_below(*num_lvs)];
+                Um_instruction old = (uintptr_t)Seq_get(stream, target);
+                Um_instruction new = lv((old >> 25) & 7,
+                                        random_below(1 << 25));
+                load_constant(stream, r4, new, r5);
+                append(stream, lv(r5, target));
+                append(stream, sstore(r0, r5, r4));
+                break;
+        }
+        default: {
+                /*
+                 * Skip the next group when a is not 0. r4 is the target,
+                 * patched once the group is written
+                 */
+                int skip = Seq_length(stream);
+                append(stream, lv(r4, 0));
+                append(stream, lv(r5, skip + 4));
+                append(stream, cmov(r5, r4, a));
+                append(stream, loadp(r0, r5));
+                append(stream, three_register(arith[random_below(4)],
+                                              a, b, c));
+                patch(stream, skip, lv(r4, Seq_length(stream)));
+                break;
+        }
+        }
+}
+
+/*
+ * Input: None
+ * Output: The data registers and scratch segment, which depend on the seed
+ * A random loop of arithmetic, segment loads and stores, maps, conditional
+ * jumps and stores into its own code, chosen by -s. The program copies
+ * itself into another segment and runs the loop from there, so a um that
+ * optimizes or compiles loaded programs only after they have run for a while
+ * switches part way through. Comparing the output of um's modes catches any
+ * that differ; there is no expected output
+ */
+void stress_random(Seq_T stream)
+{
+        int lvs[RANDOM_MAX_LVS];
+        int num_lvs = 0;
+        random_state = stress_seed;
+
+        stress_prologue(stream);
+        append(stream, lv(r3, RANDOM_SCRATCH_WORDS));
+        append(stream, activate(r1, r3));
+        append(stream, sstore(r0, r0, r1));
+
+        /* Copy segment 0 into a new segment, last word first */
+        int length_index = Seq_length(stream);
+        append(stream, lv(r3, 0));
+        append(stream, activate(r2, r3));
+        append(stream, add(r6, r3, r0));
+        append(stream, lv(r5, Seq_length(stream) + 1));
+        append(stream, add(r3, r6, r7));
+        append(stream, sload(r4, r0, r3));
+        append(stream, sstore(r2, r3, r4));
+        end_loop(stream, r0);
+
+        /* Run the rest of the program from the copy */
+        append(stream, lv(r4, Seq_length(stream) + 2));
+        append(stream, loadp(r2, r4));
+        append(stream, lv(r1, random_below(1 << 25)));
+        append(stream, lv(r2, random_below(1 << 25)));
+        append(stream, lv(r3, random_below(1 << 25)));
+
+        /* The trip count is patched in once the body is written */
+        int iterations_index = Seq_length(stream);
+        begin_loop(stream, 1);
+        int top = Seq_length(stream);
+
+        /* Without the count the registers soon repeat every iteration */
+        append(stream, add(r1, r1, r6));
+        for (int i = 0; i < RANDOM_BODY_GROUPS; i++) {
+                random_group(stream, lvs, &num_lvs);
+        }
+        append(stream, lv(r5, top));
+        end_loop(stream, r0);
+        uint32_t iterations = stress_iterations(Seq_length(stream) - top);
+        if (iterations >= (1u << 25)) {
+                iterations = (1u << 25) - 1;
+        }
+        patch(stream, iterations_index, lv(r6, iterations));
+
+        output_word(stream, r1);
+        output_word(stream, r2);
+        output_word(stream, r3);
+        for (int i = 0; i < RANDOM_SCRATCH_WORDS; i++) {
+                load_scratch_id(stream);
+                append(stream, lv(r5, i));
+                append(stream, sload(r1, r4, r5));
+                output_byte(stream, r1);
+        }
+        append(stream, halt());
+        patch(stream, length_index, lv(r3, Seq_length(stream)));
+}
@@ -1,4 +1,5 @@
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,6 +30,16 @@ extern void test_sload(Seq_T stream);
 extern void test_sstore_and_sload(Seq_T stream);
 extern void loadp_test(Seq_T stream);
 extern void loadp_seg0_test(Seq_T stream);
+extern void stress_arith(Seq_T stream);
+extern void stress_map(Seq_T stream);
+extern void stress_stream(Seq_T stream);
+extern void stress_jump(Seq_T stream);
+extern void stress_loadprogram(Seq_T stream);
+extern uint32_t stress_instructions;
+extern uint32_t stress_segment_words;
+extern uint32_t stress_program_words;
+extern void stress_random(Seq_T stream);
+extern uint32_t stress_seed;
 
 
 /* The array `tests` contains all unit tests for the lab. */
@@ -62,8 +73,22 @@ static struct test_info {
         {"input_normal_test", "A", "K",  input_normal_test}
 };
 
+
+/*
+ * Stress programs for benchmarking. They are only written when named on
+ * the command line, sized by the -n, -w and -p options
+ */
+static struct test_info stress_tests[] = {
+        {"stress_arith", NULL, "ok\n", stress_arith},
+        {"stress_map", NULL, "ok\n", stress_map},
+        {"stress_stream", NULL, "ok\n", stress_stream},
+        {"stress_jump", NULL, "ok\n", stress_jump},
+        {"stress_loadprogram", NULL, "ok\n", stress_loadprogram},
+        {"stress_random", NULL, NULL, stress_random}
+};
   
 #define NTESTS (sizeof(tests)/sizeof(tests[0]))
+#define NSTRESS (sizeof(stress_tests)/sizeof(stress_tests[0]))
 
 /*
  * open file 'path' for writing, then free the pathname;
@@ -78,6 +103,13 @@ static FILE *open_and_free_pathname(char *path);
 static void write_or_remove_file(char *path, const char *contents);
 static void write_test_files(struct test_info *test);
 
+/*
+ * if arg is a sizing option (-n instructions, -w segment words, -p program
+ * words) or -s (the seed for stress_random) followed by its value, set it
+ * and return true
+ */
+static bool parse_size_option(char *arg, char *value);
+
 
 int main (int argc, char *argv[])
 {
@@ -89,12 +121,22 @@ int main (int argc, char *argv[])
                 }
         else
                 for (int j = 1; j < argc; j++) {
+                        if (j + 1 < argc &&
+                            parse_size_option(argv[j], argv[j + 1])) {
+                                j++;
+                                continue;
+                        }
                         bool tested = false;
                         for (unsigned i = 0; i < NTESTS; i++)
                                 if (!strcmp(tests[i].name, argv[j])) {
                                         tested = true;
                                         write_test_files(&tests[i]);
                                 }
+                        for (unsigned i = 0; i < NSTRESS; i++)
+                                if (!strcmp(stress_tests[i].name, argv[j])) {
+                                        tested = true;
+                                        write_test_files(&stress_tests[i]);
+                                }
                         if (!tested) {
                                 failed = true;
                                 fprintf(stderr,
@@ -122,6 +164,33 @@ static void write_test_files(struct test_info *test)
 }
 
 
+static bool parse_size_option(char *arg, char *value)
+{
+        uint32_t *size;
+        if (!strcmp(arg, "-n"))
+                size = &stress_instructions;
+        else if (!strcmp(arg, "-w"))
+                size = &stress_segment_words;
+        else if (!strcmp(arg, "-p"))
+                size = &stress_program_words;
+        else if (!strcmp(arg, "-s"))
+                size = &stress_seed;
+        else
+                return false;
+
+        char *end;
+        unsigned long parsed = strtoul(value, &end, 10);
+        if (*value == '\0' || *end != '\0' || parsed == 0 ||
+            parsed > UINT32_MAX) {
+                fprintf(stderr, "***** Bad size %s for %s *****\n",
+                        value, arg);
+                exit(1);
+        }
+        *size = parsed;
+        return true;
+}
+
+
 static void write_or_remove_file(char *path, const char *contents)
 {
         if (contents == NULL || *contents == '\0') {